@@ -0,0 +1,55 @@
+#ifndef ARENA_H_INCLUDED
+#define ARENA_H_INCLUDED
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+/*
+* Monotonic arena backing the per file and per command state of the
+* translator (source text, decoded commands, comment strings). Nothing
+* is freed until reset() which is called between files. When a file
+* outgrows the buffer the overflow comes from the global heap, and the
+* next reset grows the buffer so later files of the same size make no
+* global allocations at all.
+*/
+class Arena : public std::pmr::memory_resource
+{
+public:
+    explicit Arena(std::size_t initialSize = 64 * 1024);
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /*
+    * Releases everything allocated so far.
+    */
+    void reset();
+
+    /*
+    * Bytes handed out since the last reset and the most ever handed
+    * out between two resets.
+    */
+    inline std::size_t used() const { return mUsed; }
+    inline std::size_t peak() const { return mPeak; }
+
+    /*
+    * Size of the buffer allocations are served from.
+    */
+    inline std::size_t capacity() const { return mCapacity; }
+
+private:
+    std::unique_ptr<std::byte[]> mBuffer;
+    std::size_t mCapacity;
+    std::optional<std::pmr::monotonic_buffer_resource> mResource;
+
+    std::size_t mUsed;
+    std::size_t mPeak;
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+};
+
+#endif // ARENA_H_INCLUDED
@@ -0,0 +1,22 @@
+#ifndef BATCH_H_INCLUDED
+#define BATCH_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+#include "VMTranslator.h"
+
+/*
+* Translates many programs in one process, each a .vm file or a
+* directory written next to its sources like a single translation.
+* Programs are the jobs of a work stealing pool of jobs threads, 0 uses
+* one per core, and only share the read-only command and segment
+* tables. A failing program is reported and the rest carry on. manifest,
+* when given, lists more programs one per line, relative to itself.
+* Prints every program's result in the given order and the totals,
+* returns true when all of them translated.
+*/
+bool batch_translate(const std::vector<std::string>& programs, const std::string& manifest,
+    const TranslatorOptions& options, unsigned jobs);
+
+#endif // BATCH_H_INCLUDED
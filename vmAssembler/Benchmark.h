@@ -0,0 +1,13 @@
+#ifndef BENCHMARK_H_INCLUDED
+#define BENCHMARK_H_INCLUDED
+
+#include <string>
+
+/*
+* Times the line scanning, comment stripping and trimming of a .vm file
+* using the original std::getline / std::isspace routines and the
+* vectorized scanner, and prints the throughput of both.
+*/
+void benchmarkScanner(const std::string& fileName, int rounds = 10);
+
+#endif // BENCHMARK_H_INCLUDED
@@ -1,40 +1,149 @@
 #ifndef CODEWRITER_H_INCLUDED
 #define CODEWRITER_H_INCLUDED
 
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <fstream>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "Parser.h"
+#include "SymbolTable.h"
 
 class CodeWriter
 {
 public:
-    CodeWriter(const std::string& name);
+    /*
+    * Call, comparison and return sites can either be expanded in place
+    * or jump to a routine shared by every site of the same kind.
+    */
+    enum class SiteKind
+    {
+        CALL,
+        COMPARISON,
+        RETURN,
+    };
+
+    struct Site
+    {
+        SiteKind kind;
+
+        /*
+        * Index into Layout::functions of the enclosing function.
+        */
+        std::size_t function;
+
+        /*
+        * ROM address of the first instruction and the number of
+        * instructions written for the site.
+        */
+        std::size_t address;
+        std::size_t size;
+
+        /*
+        * Instructions the site takes when it uses the shared routine.
+        */
+        std::size_t sharedSize;
+
+        /*
+        * Which shared routine, the jump of a comparison (JEQ, JGT, JLT).
+        */
+        int variant;
+        bool shared;
+
+        /*
+        * The function called by a call site.
+        */
+        SymbolTable::Id callee;
+    };
+
+    struct FunctionInfo
+    {
+        SymbolTable::Id name;
+        std::size_t address;
+        std::size_t size;
+    };
+
+    /*
+    * Where everything ended up in ROM, collected while writing.
+    */
+    struct Layout
+    {
+        std::vector<Site> sites;
+        std::vector<FunctionInfo> functions;
+
+        /*
+        * Label and jump address of every backward goto / if-goto.
+        */
+        std::vector<std::pair<std::size_t, std::size_t>> loops;
+    };
+
+    /*
+    * Sites to emit as shared, indexed per kind in the order they
+    * are written. Sites not covered are expanded in place.
+    */
+    struct SizePlan
+    {
+        std::vector<bool> sharedCalls;
+        std::vector<bool> sharedComparisons;
+        std::vector<bool> sharedReturns;
+    };
+
+public:
+    /*
+    * Writes to the file name, or to buffer when one is given in which
+    * case no file is opened and restart() is not available.
+    */
+    CodeWriter(const std::string& name, SymbolTable& symbols, std::streambuf* buffer = nullptr);
+
+    /*
+    * Sends everything written from now on to buffer, or back to the
+    * file when buffer is nullptr. Used to keep one fragment per file.
+    */
+    void setOutput(std::streambuf* buffer);
+
     /*
     * Writes the resulting arithmetic operation to the file using
     * a series of popping and pushing values to the stack
     */
-    void writeArithmetic(const std::string& cmd);
+    void writeArithmetic(std::string_view cmd);
 
 
     /*
     * Implements unconditional goto jump, conditional goto jump
-    * and inserts labels in the assembly stream.
+    * and inserts labels in the assembly stream. Labels are interned
+    * symbols and are scoped to the current function when add_prefix is set.
     */
-    void writeGoto(const std::string& label, bool add_prefix = true);
-    void writeLabel(const std::string& label, bool add_prefix = true);
-    void writeIf(const std::string& label, bool add_prefix = true);
+    void writeGoto(SymbolTable::Id label, bool add_prefix = true);
+    void writeLabel(SymbolTable::Id label, bool add_prefix = true);
+    void writeIf(SymbolTable::Id label, bool add_prefix = true);
 
     /*
     * Implements the push and pop syntax.
     */
-    void writePushPop(Parser::Command cmd, const std::string& segment, int index, bool ld_frm_d = false);
+    void writePushPop(Parser::Command cmd, std::string_view segment, int index, bool ld_frm_d = false);
 
     /*
     * Generates a more optimize push pop assignment command. Better for assignment
     * when a push command is followed immediately by a pop command.
     */
-    void opt_assignment_op(int const_val, const std::string& segment, int index);
+    void opt_assignment_op(int const_val, std::string_view segment, int index);
+
+    /*
+    * Fused array accesses. writeArrayRead replaces add; pop pointer 1;
+    * push that 0 and writeArrayWrite the store tail pop temp 0;
+    * pop pointer 1; push temp 0; pop that 0. The element address is
+    * formed once in A, THAT and temp 0 are only written when set.
+    */
+    void writeArrayRead(bool setThat);
+    void writeArrayWrite(bool setThat, bool setTemp);
 
     /*
     * Closes the file after writing.
@@ -42,28 +151,60 @@ public:
     void close();
 
     /*
-    * Changes the currently interpreted .vm file
+    * Changes the currently interpreted .vm file. Generated labels are
+    * numbered per file so a file always translates to the same text.
     */
     void setFileName(const std::string& file_name);
 
     /*
     * Generates a function into hack assembly
     */
-    void writeFunction(const std::string& func_name, int nVars);
+    void writeFunction(SymbolTable::Id func_name, int nVars);
 
     /*
-    * Implements the returning of a function
+    * Implements the returning of a function. writeReturnConstant
+    * returns value without it being pushed first. THIS and THAT are
+    * only restored from the frame when the function may have changed
+    * them, calls always leave them as they were.
     */
-    void writeReturn();
+    void writeReturn(bool restoreThis = true, bool restoreThat = true);
+    void writeReturnConstant(int value, bool restoreThis = true, bool restoreThat = true);
 
     /*
     * Generates assembly instructions for call command
     */
-    void writeCall(const std::string& func_name, int nVars);
+    void writeCall(SymbolTable::Id func_name, int nVars);
+
+    /*
+    * Multiplies the top of the stack by a constant in place, the
+    * expansion of C_MULTIPLY. multiplySize is the number of words it
+    * takes, past MAX_INLINE_MULTIPLY the call is shorter.
+    */
+    void writeMultiply(int constant);
+    static std::size_t multiplySize(int constant);
+    static constexpr std::size_t MAX_INLINE_MULTIPLY = 32;
+
+    /*
+    * Divides the top of the stack by 2^k in place, the expansion of
+    * C_DIVIDE, rounding toward zero like Math.divide. Hack has no
+    * shift, so the bits k..14 of |x| are tested one by one, 10 words
+    * each. Past MAX_INLINE_DIVIDE, a quotient of more than 4 bits, the
+    * call stays as the size planner can not take inline code back.
+    */
+    void writeDivide(int powerOfTwo);
+    static std::size_t divideSize(int powerOfTwo);
+    static constexpr std::size_t MAX_INLINE_DIVIDE = 61;
+
+    /*
+    * Words of push constant k; call f 2 written inline, the most an
+    * inline divide may take under -Os.
+    */
+    static constexpr std::size_t CONSTANT_CALL_SIZE = 56;
+
     /*
     * Writes the stack instruction to file as a comment.
     */
-    inline void writeComment(const std::string& str) { mFile << "// " << str << '\n'; }
+    inline void writeComment(std::string_view str) { mFile << "// " << str << '\n'; }
 
     /*
     * Ends the whole program by writing an infinite loop.
@@ -72,28 +213,140 @@ public:
 
     inline void writeInfiniteLoop() { mFile << "\n"; }
 
+    /*
+    * Writes the shared call, comparison and return routines
+    * used by at least one site. Called once after the last file.
+    */
+    void writeSharedRoutines();
+
+    /*
+    * While collecting, every function is written to a buffer of its
+    * own. writeFunctions then outputs the functions named in first in
+    * that order followed by the rest in the order they were written.
+    */
+    void collectFunctions(bool collect);
+    void writeFunctions(const std::vector<SymbolTable::Id>& first);
+
+    /*
+    * Truncates the output and starts over with the bootstrap code,
+    * emitting the sites selected by plan through shared routines.
+    */
+    void restart(const SizePlan& plan);
+
+    /*
+    * Forgets the layout and label addresses recorded so far, for
+    * translating files one at a time into fragments that are kept.
+    */
+    void startFragment();
+
+    /*
+    * Makes room in the layout for the sites, functions and jumps of
+    * code up front, so recording them does not allocate per command.
+    */
+    void reserveLayout(const std::pmr::vector<Parser::Instruction>& code);
+
+    /*
+    * Number of Hack instructions written so far, i.e. the ROM size.
+    */
+    inline std::size_t romSize() const { return mRomSize; }
+    inline const Layout& layout() const { return mLayout; }
+
+    /*
+    * Size of one shared routine of the given kind.
+    */
+    static std::size_t routineSize(SiteKind kind);
+
 private:
     /*
-    * Opens a file for writing to.
+    * The output file and the stream written to, which normally
+    * goes to the file but can be pointed at any buffer.
     */
-    std::ofstream mFile;
+    std::filebuf mFileBuf;
+    std::ostream mFile;
+
+    /*
+    * Interned labels, function names and static identifiers, shared
+    * with the Parser.
+    */
+    SymbolTable& mSymbols;
+
+    /*
+    * Path of the output file, reopened by restart().
+    */
+    std::string mPath;
 
     /*
     * Name of the opened file.
     */
-    std::string mName;
+    SymbolTable::Id mName;
 
     /*
     * The name of the current function being processed
     */
-    std::string currFunctionName;
+    SymbolTable::Id currFunctionName;
+
+    /*
+    * Instructions written so far and where they went.
+    */
+    std::size_t mRomSize;
+    Layout mLayout;
+
+    /*
+    * Address of every label of the current function by label id, an
+    * entry only counts while its scope matches mLabelScope. Starting a
+    * function bumps the scope instead of clearing, so writing labels
+    * allocates only when the symbol table has grown.
+    */
+    std::vector<std::pair<std::uint32_t, std::size_t>> mLabelAddress;
+    std::uint32_t mLabelScope;
+
+    /*
+    * Records a loop when label was placed before the jump to it.
+    */
+    void recordJump(SymbolTable::Id label);
+
+    /*
+    * Empties the layout keeping its storage, and forgets the labels.
+    */
+    void clearLayout();
+
+    /*
+    * Which sites use the shared routines and which routines to write.
+    */
+    SizePlan mPlan;
+    std::size_t mCallSites;
+    std::size_t mComparisonSites;
+    std::size_t mReturnSites;
+    bool mUseCallRoutine;
+    bool mUseReturnRoutine;
+    bool mUseCompareRoutine[3];
+
+    /*
+    * Functions held back by collectFunctions and where the output
+    * went before the first of them.
+    */
+    struct FunctionText
+    {
+        SymbolTable::Id name;
+        std::stringbuf text;
+        bool written;
+    };
+    bool mCollectFunctions;
+    std::deque<FunctionText> mFunctionText;
+    std::streambuf* mCollectTarget;
+
+    /*
+    * Counters keeping return labels, and comparison and divide labels, unique.
+    */
+    int mRetCounter;
+    int mCompCounter;
 
     /*
     * Push constant to the stack or access
     * an indexed address from where LCL, ARG,
     * THIS. THAT points to.
     */
-    void accessIdxAddrOrLdMem(int index, const std::string& seg);
+    void accessIdxAddrOrLdMem(int index, std::string_view seg);
 
     /*
     * Initializes and bootstraps the assembly file
@@ -103,30 +356,42 @@ private:
     /*
     * Generates identifiers for static variables by concatenating
     * the file name and the number separated by a '.'. Also generates
-    * identifiers for temp, hidden and pointer access.
+    * identifiers for temp, hidden and pointer access. Static names
+    * are interned so the returned view outlives the call.
     */
-    std::string directQualName(int index, const std::string& segment);
+    std::string_view directQualName(int index, std::string_view segment);
 
     /*
     * Implements every possible combinations of Hack assembly commands
     * using overloaded functions.
     */
-    void wrtBaseCmd(const std::string& seg, char to, char from, bool ld_seg = true);
+    void wrtBaseCmd(std::string_view seg, char to, char from, bool ld_seg = true);
     void wrtBaseCmd(int seg, char to, char op1, char op, char op2, bool ld_seg = true);
     void wrtBaseCmd(int seg, char to, char from, bool ld_seg = true);
-    void wrtBaseCmd(const std::string& seg, char to, char op1, char op, char op2, bool ld_seg = true);
-    void wrtBaseCmd(const std::string& seg, char comp_val, const std::string& comp_op, bool ld_seg = true);
-    void wrtBaseCmd(const std::string& seg, char to, char op, char op1, bool ld_seg = true);
+    void wrtBaseCmd(std::string_view seg, char to, char op1, char op, char op2, bool ld_seg = true);
+    void wrtBaseCmd(std::string_view seg, char comp_val, std::string_view comp_op, bool ld_seg = true);
+    void wrtBaseCmd(std::string_view seg, char to, char op, char op1, bool ld_seg = true);
 
     /*
     * Implements a binary operation on two operands.
     */
-    void implementArith(const std::string& sign, bool binary = true, const std::string& cmp_sign = "");
+    void implementArith(std::string_view sign, bool binary = true, std::string_view cmp_sign = {});
+
+    /*
+    * Records a call, comparison or return site started at address.
+    */
+    void recordSite(SiteKind kind, std::size_t address, bool shared, std::size_t sharedSize, int variant = 0,
+        SymbolTable::Id callee = 0);
+    bool isShared(const std::vector<bool>& plan, std::size_t ordinal) const;
+
+    /*
+    * Writes a raw line that is a single Hack instruction.
+    */
+    void wrtRaw(std::string_view line);
 
     void __push(const char* segment, bool ret_addr = false);
-    void __push(const std::string& segment);
-    void __restorePointer(const char* segment, int index);
-    std::string __gen_label_name(const std::string& label, bool add_prefix);
+    void __returnBody(bool restoreThis, bool restoreThat, bool constant = false, int value = 0);
+    std::string_view __gen_label_name(SymbolTable::Id label, bool add_prefix);
 
 };
 
@@ -0,0 +1,69 @@
+#ifndef HACKEMULATOR_H_INCLUDED
+#define HACKEMULATOR_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+* Assembles a .asm file and runs it on a Hack CPU, used to check that
+* optimized output computes the same as unoptimized output. Variables
+* are allocated from RAM[16] in order of first use like the standard
+* assembler. The program halts on the usual end of program loop, a
+* label followed by an unconditional jump back to it.
+*/
+class HackEmulator
+{
+public:
+    static constexpr std::size_t RAM_SIZE = 32768;
+
+public:
+    /*
+    * Throws std::runtime_error on a file that cannot be read or an
+    * instruction that does not assemble.
+    */
+    explicit HackEmulator(const std::string& fileName);
+
+    /*
+    * Runs at most maxCycles instructions from the current state and
+    * returns how many ran.
+    */
+    std::uint64_t run(std::uint64_t maxCycles);
+
+    inline bool halted() const { return mHalted; }
+    inline std::size_t romSize() const { return mRom.size(); }
+    inline const std::int16_t* ram() const { return mRam.data(); }
+
+    /*
+    * Address of every variable the assembler allocated, by name.
+    */
+    inline const std::map<std::string, std::uint16_t>& variables() const { return mVariables; }
+
+private:
+    /*
+    * Decoded instruction. A instructions load value, C instructions
+    * keep the a bit and the six ALU control bits in comp.
+    */
+    struct Instruction
+    {
+        bool isA;
+        std::uint16_t value;
+        std::uint8_t comp;
+        std::uint8_t dest;
+        std::uint8_t jump;
+    };
+
+    std::vector<Instruction> mRom;
+    std::vector<std::int16_t> mRam;
+    std::map<std::string, std::uint16_t> mVariables;
+    std::uint16_t mA;
+    std::uint16_t mD;
+    std::size_t mPc;
+    bool mHalted;
+
+    static std::int16_t alu(std::uint8_t control, std::uint16_t x, std::uint16_t y);
+};
+
+#endif // HACKEMULATOR_H_INCLUDED
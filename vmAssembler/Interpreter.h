@@ -0,0 +1,151 @@
+#ifndef INTERPRETER_H_INCLUDED
+#define INTERPRETER_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Parser.h"
+#include "SymbolTable.h"
+
+/*
+* Runs VM programs directly instead of translating them. Commands are
+* decoded once into a flat array with jump targets and callees resolved,
+* and executed on a simulated 32K word Hack RAM using the same layout as
+* the CodeWriter output: SP at 256, LCL/ARG/THIS/THAT in RAM[1..4], temp
+* at R5 and statics from 16. Return addresses live on a host-side stack,
+* the words pushed in their place are kept so frames look the same.
+*/
+class Interpreter
+{
+public:
+    static constexpr std::size_t RAM_SIZE = 32768;
+
+    struct FunctionStats
+    {
+        SymbolTable::Id name;
+        std::uint64_t calls;
+        std::uint64_t instructions;
+    };
+
+public:
+    Interpreter(SymbolTable& symbols);
+
+    /*
+    * Decodes a .vm file and appends it to the program.
+    */
+    void load(const std::string& fileName, unsigned parseThreads = 1);
+
+    /*
+    * Resolves labels and callees and bootstraps the machine by calling
+    * Sys.init like the CodeWriter does. Throws on unresolved names.
+    */
+    void link();
+
+    /*
+    * Executes until Sys.init returns, a label jumps to itself (the usual
+    * end of program loop) or maxSteps VM instructions have run.
+    * Returns the number of instructions executed.
+    */
+    std::uint64_t run(std::uint64_t maxSteps);
+
+    /*
+    * True when the last run stopped by halting rather than on maxSteps.
+    */
+    inline bool halted() const { return mHalted; }
+
+    inline const std::int16_t* ram() const { return mRam.data(); }
+
+    /*
+    * Instruction counts per function, most executed first.
+    */
+    std::vector<FunctionStats> functionStats() const;
+    void writeReport(std::ostream& out, std::size_t top = 20) const;
+
+    /*
+    * Writes the counts of every function and caller/callee pair in the
+    * format Profile reads, for translating with --profile-use.
+    */
+    void writeProfile(std::ostream& out) const;
+
+private:
+    enum class OpCode : std::uint8_t
+    {
+        PUSH_CONSTANT,
+        PUSH_SEGMENT,
+        PUSH_DIRECT,
+        POP_SEGMENT,
+        POP_DIRECT,
+        ADD,
+        SUB,
+        NEG,
+        AND,
+        OR,
+        NOT,
+        EQ,
+        GT,
+        LT,
+        GOTO,
+        IF_GOTO,
+        FUNCTION,
+        CALL,
+        RETURN,
+        HALT,
+    };
+
+    /*
+    * A decoded command. For segments a is the RAM pointer (LCL...)
+    * and b the index, for temp/static/pointer a is the address. Jumps
+    * and calls hold the target op in a, calls keep nArgs in b and
+    * functions keep nLocals in a and their index in b.
+    */
+    struct Op
+    {
+        OpCode code;
+        std::int32_t a;
+        std::int32_t b;
+    };
+
+    struct Fixup
+    {
+        std::size_t op;
+        SymbolTable::Id target;
+    };
+
+    struct Frame
+    {
+        std::size_t returnOp;
+        std::int32_t function;
+    };
+
+    SymbolTable& mSymbols;
+    std::vector<Op> mOps;
+
+    std::unordered_map<SymbolTable::Id, std::size_t> mLabels;
+    std::unordered_map<SymbolTable::Id, std::size_t> mFunctionOps;
+    std::unordered_map<SymbolTable::Id, std::int32_t> mStatics;
+    std::vector<Fixup> mJumpFixups;
+    std::vector<Fixup> mCallFixups;
+
+    std::vector<FunctionStats> mStats;
+    std::vector<std::uint64_t> mCallCounts;
+    std::vector<Frame> mFrames;
+    std::vector<std::int16_t> mRam;
+
+    std::size_t mPc;
+    std::int32_t mFunction;
+    bool mHalted;
+};
+
+/*
+* Runs the .vm file or directory f and prints the per function report.
+* dumpBegin/dumpEnd select a RAM range to print after the run and the
+* profile is written to profileName when one is given.
+*/
+void interpret_VM_files(const std::string& f, unsigned parseThreads, std::uint64_t maxSteps,
+    int dumpBegin = 0, int dumpEnd = 0, const std::string& profileName = {});
+
+#endif // INTERPRETER_H_INCLUDED
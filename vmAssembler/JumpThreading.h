@@ -0,0 +1,28 @@
+#ifndef JUMPTHREADING_H_INCLUDED
+#define JUMPTHREADING_H_INCLUDED
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "Parser.h"
+#include "SymbolTable.h"
+
+struct JumpThreadingStats
+{
+    std::size_t retargeted{ 0 };
+    std::size_t gotosRemoved{ 0 };
+    std::size_t labelsRemoved{ 0 };
+};
+
+/*
+* Control flow clean up over the commands of one file. Jumps to a label
+* followed by a goto are sent straight to where the chain of gotos ends,
+* a goto to a label that immediately follows it is deleted and labels
+* nothing jumps to any more are removed. Labels are function scoped so
+* chains never leave the function they start in.
+*/
+JumpThreadingStats threadJumps(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+#endif // JUMPTHREADING_H_INCLUDED
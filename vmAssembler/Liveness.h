@@ -0,0 +1,63 @@
+#ifndef LIVENESS_H_INCLUDED
+#define LIVENESS_H_INCLUDED
+
+#include <cstddef>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include "Parser.h"
+#include "SymbolTable.h"
+
+/*
+* Answers whether a later command of the file can read THAT or temp 0
+* before it is overwritten. Paths are followed through goto and
+* if-goto within the function. Anything the walk cannot see through
+* (calls, falling into another function, the end of the file, very long
+* paths) counts as a read so the answer is only ever too cautious.
+*/
+class Liveness
+{
+public:
+    enum class Location
+    {
+        THAT,
+        TEMP0,
+    };
+
+public:
+    Liveness(const std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols,
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+    /*
+    * True when loc may be read by the command at position from or a
+    * command reachable from it. function is the enclosing function,
+    * labels are looked up in its scope.
+    */
+    bool isLive(Location loc, std::size_t from, SymbolTable::Id function) const;
+
+private:
+    enum class Effect
+    {
+        NONE,
+        READ,
+        WRITE,
+    };
+
+    const std::pmr::vector<Parser::Instruction>& mCode;
+    SymbolTable& mSymbols;
+    std::pmr::memory_resource* mMemory;
+
+    /*
+    * Position of every label, keyed by function$label.
+    */
+    std::pmr::unordered_map<SymbolTable::Id, std::size_t> mLabels;
+
+    SymbolTable::Id mPointer;
+    SymbolTable::Id mThat;
+    SymbolTable::Id mTemp;
+
+    Effect effectOf(Location loc, const Parser::Instruction& instr) const;
+};
+
+#endif // LIVENESS_H_INCLUDED
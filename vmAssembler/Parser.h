@@ -2,9 +2,12 @@
 #define PARSER_H_INCLUDED
 
 #include <map>
+#include <memory_resource>
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include "SymbolTable.h"
 
 
 class Parser
@@ -24,23 +27,71 @@ public:
         C_CALL,
         C_RETURN,
         C_NOT_IMPLEMENTED,
+
+        // Fused commands, only produced by the optimization passes
+        C_ASSIGN,
+        C_MULTIPLY,
+        C_ARRAY_READ,
+        C_ARRAY_WRITE,
+        C_DIVIDE,
+    };
+
+    /*
+    * A pre-tokenized command. Every word is interned in the SymbolTable
+    * the Parser was created with.
+    */
+    struct Instruction
+    {
+        Command type;
+
+        /*
+        * The command word as written (push, add, label...).
+        */
+        SymbolTable::Id op;
+
+        /*
+        * Segment, label or function name. Same as op for arithmetic.
+        */
+        SymbolTable::Id arg1;
+        int arg2;
+
+        /*
+        * Extra operand of fused commands: the constant of C_ASSIGN
+        * (arg1 arg2 being the target) and whether C_ARRAY_WRITE also
+        * sets temp 0. C_MULTIPLY and C_DIVIDE keep their constant in arg2 and the
+        * array commands whether they set THAT. C_RETURN keeps in arg3
+        * the pointers the function never changes (RETURN_KEEPS_THIS,
+        * RETURN_KEEPS_THAT) and, when a constant is returned, has
+        * arg1 constant and the value in arg2.
+        */
+        int arg3{ 0 };
     };
 
+    static constexpr int RETURN_KEEPS_THIS = 1;
+    static constexpr int RETURN_KEEPS_THAT = 2;
+
 public:
-    Parser(const std::string& fileName);
+    /*
+    * Reads and tokenizes the whole file. With more than one thread the
+    * file is split at newline boundaries and the chunks are tokenized
+    * in parallel, then stitched back together in order. 0 uses one
+    * thread per core. The source text, the decoded commands and the
+    * strings returned by returnCommand are allocated from memory.
+    */
+    Parser(const std::string& fileName, SymbolTable& symbols, unsigned threads = 1,
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource());
 
     /*
     * Returns true if open file still has lines to process
     * false otherwise.
     */
-    inline bool hasMoreLines() { return !mFile.eof(); };
+    inline bool hasMoreLines() { return mNext < mInstructions.size(); };
 
     /*
-    * Advances the file pointer to the next command, skips
-    * whitespace and comments.
+    * Advances to the next command, whitespace and comments
+    * have already been skipped while tokenizing.
     */
     void advance();
-    void __advance(std::stringstream& strm);
 
     /*
     * Returns the type of command the current line implements.
@@ -48,35 +99,71 @@ public:
     Command commandType();
     Command peekNxtCommandType();
 
+
     /*
     * Returns the arg1 of the current line.
     */
-    std::string arg1();
+    std::string_view arg1();
+
+    /*
+    * Returns arg1 of the current line as an interned symbol, used
+    * for labels and function names.
+    */
+    SymbolTable::Id arg1Symbol();
 
     /*
     * Returns the arg1 of the current line.
     */
     int arg2();
 
+    /*
+    * Returns the extra operand of a fused command.
+    */
+    int arg3();
+
     /*
     * Returns the current line, used for implementing comments in source code.
     */
-    std::string returnCommand();
+    std::pmr::string returnCommand();
 
+    /*
+    * Returns every command of the file in source order.
+    */
+    inline const std::pmr::vector<Instruction>& instructions() const { return mInstructions; }
+
+    /*
+    * Lets passes rewrite the commands, only before the first advance().
+    */
+    inline std::pmr::vector<Instruction>& instructions() { return mInstructions; }
 
 private:
-    std::ifstream mFile;
+    /*
+    * Table shared with the CodeWriter where names are interned.
+    */
+    SymbolTable& mSymbols;
+
+    std::pmr::memory_resource* mMemory;
+    std::pmr::vector<Instruction> mInstructions;
+
+    /*
+    * Current command and the one peekNxtCommandType looks at.
+    */
+    std::size_t mCurrent;
+    std::size_t mNext;
 
     /*
-    * Current command.
+    * Splits text into chunks and tokenizes them on a pool of threads.
+    * Returns the first malformed line like tokenize.
     */
-    std::stringstream mCommand;
-    std::stringstream mNxtCommand;
+    const char* parseParallel(const std::pmr::string& text, unsigned threads);
 
     /*
-    * Resets the stream to beginning after seeking.
+    * Tokenizes every line in [begin, end) and appends the commands to out.
+    * Stops at a push or pop with an index out of range for its segment
+    * and returns the start of that line, nullptr when every line is fine.
     */
-    void resetStream(std::stringstream& strm);
+    static const char* tokenize(const char* begin, const char* end, std::pmr::vector<Instruction>& out,
+        SymbolTable& symbols);
 };
 
 
@@ -0,0 +1,89 @@
+#ifndef PASSMANAGER_H_INCLUDED
+#define PASSMANAGER_H_INCLUDED
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <memory_resource>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "Parser.h"
+#include "SymbolTable.h"
+
+/*
+* Runs the enabled optimization passes over the commands of each file
+* before code generation and keeps per pass counters. Passes are named
+* so each can be switched on or off on its own (-fname / -fno-name)
+* on top of an -O level, which is how a miscompile gets bisected.
+*/
+class PassManager
+{
+public:
+    /*
+    * In the order they run.
+    */
+    enum class Pass
+    {
+        JUMP_THREADING,
+        ARRAY_FUSION,
+        MATH_INLINE,
+        CONST_ASSIGN,
+        LEAN_RETURN,
+    };
+    static constexpr std::size_t PASS_COUNT = 5;
+    static constexpr int MAX_LEVEL = 2;
+
+    /*
+    * Without -O: the passes that keep code size where it was, -O2 and
+    * its inline multiply, divide and array accesses are opt-in.
+    */
+    static constexpr int DEFAULT_LEVEL = 1;
+
+public:
+    /*
+    * Enables the passes of the given -O level.
+    */
+    explicit PassManager(int level = DEFAULT_LEVEL);
+
+    void setLevel(int level);
+
+    /*
+    * Returns false when no pass has that name.
+    */
+    bool setEnabled(std::string_view name, bool enabled);
+    inline bool enabled(Pass pass) const { return mEnabled[static_cast<std::size_t>(pass)]; }
+
+    static std::string_view name(Pass pass);
+
+    /*
+    * Under -Os passes leave out rewrites that may come out longer than
+    * the code they replace, as the size planner can not undo them.
+    */
+    inline void setOptimizeSize(bool optimizeSize) { mOptimizeSize = optimizeSize; }
+
+    void run(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols);
+
+    /*
+    * Time, command counts before and after and rewrites per pass,
+    * summed over every run since the last resetStats().
+    */
+    void resetStats();
+    void writeReport(std::ostream& out) const;
+
+private:
+    struct Stats
+    {
+        std::size_t before{ 0 };
+        std::size_t after{ 0 };
+        std::size_t rewrites{ 0 };
+        std::chrono::steady_clock::duration time{};
+    };
+
+    std::array<bool, PASS_COUNT> mEnabled;
+    std::array<Stats, PASS_COUNT> mStats;
+    bool mOptimizeSize;
+};
+
+#endif // PASSMANAGER_H_INCLUDED
@@ -0,0 +1,49 @@
+#ifndef PEEPHOLE_H_INCLUDED
+#define PEEPHOLE_H_INCLUDED
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+#include "Parser.h"
+#include "SymbolTable.h"
+
+/*
+* Rewrites over the commands of one file that replace short command
+* sequences with a fused command the CodeWriter has a cheaper expansion
+* for. Each returns the number of sequences it replaced. Scratch memory
+* comes from the resource code was allocated from.
+*/
+
+/*
+* add; pop pointer 1; push that 0 becomes C_ARRAY_READ and the store
+* tail pop temp 0; pop pointer 1; push temp 0; pop that 0 becomes
+* C_ARRAY_WRITE, recording whether THAT and temp 0 are read later.
+*/
+std::size_t fuseArrayAccess(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols);
+
+/*
+* push constant k; call Math.multiply 2 becomes C_MULTIPLY when the
+* inline code is short enough, and call Math.divide 2 becomes C_DIVIDE
+* when k is a large enough power of two. Optimizing for size a divide
+* is only inlined when no longer than the call written inline, as the
+* size planner can not take it back. Multiplying or dividing by 1 is
+* dropped.
+*/
+std::size_t inlineConstantMath(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols,
+    bool optimizeSize = false);
+
+/*
+* push constant k; pop segment i becomes C_ASSIGN, writing the constant
+* without going through the stack.
+*/
+std::size_t foldConstantAssignments(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols);
+
+/*
+* push constant k; return returns k without the push, and every return
+* of a function that never pops pointer 0 or 1 is marked so THIS and
+* THAT are not restored. Calls leave them as they were.
+*/
+std::size_t specializeReturns(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols);
+
+#endif // PEEPHOLE_H_INCLUDED
@@ -0,0 +1,54 @@
+#ifndef PROFILE_H_INCLUDED
+#define PROFILE_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "SymbolTable.h"
+
+/*
+* Execution counts read from a profile written by --run
+* --profile-generate: instructions per function and calls per caller
+* and callee pair. Functions covering HOT_COVERAGE of the executed
+* instructions, most executed first, are hot, the rest are cold.
+*/
+class Profile
+{
+public:
+    static constexpr double HOT_COVERAGE = 0.99;
+
+public:
+    /*
+    * Reads the profile, throws when it can not be opened or a line
+    * is malformed. Names are interned into symbols.
+    */
+    Profile(const std::string& fileName, SymbolTable& symbols);
+
+    /*
+    * Times caller called callee.
+    */
+    std::uint64_t calls(SymbolTable::Id caller, SymbolTable::Id callee) const;
+
+    /*
+    * Hot functions, most executed first with ties broken by name so
+    * a profile always gives the same order.
+    */
+    inline const std::vector<SymbolTable::Id>& hotFunctions() const { return mHot; }
+    inline bool isHot(SymbolTable::Id function) const { return mHotSet.count(function) != 0; }
+
+private:
+    std::unordered_map<SymbolTable::Id, std::uint64_t> mInstructions;
+
+    /*
+    * Keyed by caller in the high and callee in the low 32 bits.
+    */
+    std::unordered_map<std::uint64_t, std::uint64_t> mCalls;
+
+    std::vector<SymbolTable::Id> mHot;
+    std::unordered_set<SymbolTable::Id> mHotSet;
+};
+
+#endif // PROFILE_H_INCLUDED
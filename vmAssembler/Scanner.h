@@ -0,0 +1,53 @@
+#ifndef SCANNER_H_INCLUDED
+#define SCANNER_H_INCLUDED
+
+/*
+* Byte scanning primitives used to split .vm source into lines and
+* words. They look at 32 (AVX2) or 16 (SSE2) bytes at a time when the
+* target supports it and fall back to plain loops otherwise. Every
+* function returns end when nothing is found.
+*/
+
+#if defined(__AVX2__)
+#define SCANNER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCANNER_SSE2
+#endif
+
+namespace scanner
+{
+    // Same set as std::isspace in the "C" locale
+    inline bool isSpace(char c)
+    {
+        return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+    }
+
+    /*
+    * Returns the first occurrence of c in [p, end).
+    */
+    const char* findChar(const char* p, const char* end, char c);
+
+    /*
+    * Returns the start of the first "//" comment in [p, end).
+    */
+    const char* findComment(const char* p, const char* end);
+
+    /*
+    * Returns the first whitespace / non whitespace byte in [p, end).
+    */
+    const char* findSpace(const char* p, const char* end);
+    const char* skipSpace(const char* p, const char* end);
+
+    /*
+    * Returns one past the last non whitespace byte in [begin, end),
+    * begin if there is none.
+    */
+    const char* rskipSpace(const char* begin, const char* end);
+
+    /*
+    * Name of the instruction set picked at compile time.
+    */
+    const char* isaName();
+}
+
+#endif // SCANNER_H_INCLUDED
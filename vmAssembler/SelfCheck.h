@@ -0,0 +1,25 @@
+#ifndef SELFCHECK_H_INCLUDED
+#define SELFCHECK_H_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+#include "VMTranslator.h"
+
+/*
+* Translates every program of corpus twice, at -O0 and with options,
+* runs both on the HackEmulator and compares the final RAM. corpus is
+* either one program or a directory of program directories, e.g.
+* vmAssembler --self-check -O2 corpus. Statics are compared by name,
+* SP/LCL/ARG/THIS/THAT, temp, the stack below SP and the heap by
+* address. Not compared: R13-R15 scratch, words above SP, the return
+* addresses in the frames and, with array-fusion on, THAT, temp 0 and
+* the THAT saved in each frame, whose dead writes that pass skips. Only
+* the final state is seen, a wrong value later overwritten is missed.
+* With -Os the program must also be no larger than without it.
+* Returns true when every program halted within maxCycles with the
+* same RAM.
+*/
+bool selfCheck(const std::string& corpus, const TranslatorOptions& options, std::uint64_t maxCycles);
+
+#endif // SELFCHECK_H_INCLUDED
@@ -0,0 +1,49 @@
+#ifndef SIZEOPTIMIZER_H_INCLUDED
+#define SIZEOPTIMIZER_H_INCLUDED
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+#include "CodeWriter.h"
+#include "Profile.h"
+#include "SymbolTable.h"
+
+/*
+* The Hack ROM holds 32K instructions.
+*/
+constexpr std::size_t HACK_ROM_SIZE = 32768;
+
+/*
+* Picks the call, comparison and return sites to move to shared
+* routines so a program laid out as layout fits in budget. Sites
+* outside of loops go first, largest saving first, so hot code keeps
+* the inline fast path as long as possible. Only routines whose sites
+* together save more than the routine takes are used, and when that
+* is not enough to get any smaller an empty plan, all inline, is
+* returned. hot, one entry per site, replaces the loop based guess
+* when given.
+*/
+CodeWriter::SizePlan planForBudget(const CodeWriter::Layout& layout, std::size_t romSize, std::size_t budget,
+    const std::vector<bool>& hot = {});
+
+/*
+* Marks the sites on the hot paths of a profile: every site of a hot
+* function except calls its caller/callee pair never made.
+*/
+std::vector<bool> profileHotSites(const CodeWriter::Layout& layout, const Profile& profile);
+
+/*
+* Moves every cold site to the shared routines, for each routine only
+* when its cold sites together save more than the routine takes.
+*/
+CodeWriter::SizePlan planForProfile(const CodeWriter::Layout& layout, const std::vector<bool>& hot);
+
+/*
+* Prints the ROM usage and the largest functions together with how
+* their call, comparison and return sites were emitted.
+*/
+void writeSizeReport(std::ostream& out, const CodeWriter::Layout& layout, const SymbolTable& symbols,
+    std::size_t romSize, std::size_t budget, std::size_t top = 10);
+
+#endif // SIZEOPTIMIZER_H_INCLUDED
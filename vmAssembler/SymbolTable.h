@@ -0,0 +1,95 @@
+#ifndef SYMBOLTABLE_H_INCLUDED
+#define SYMBOLTABLE_H_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class SymbolTable
+{
+public:
+    using Id = std::uint32_t;
+
+public:
+    SymbolTable();
+
+    /*
+    * Returns the id of the given name, copying the text into the
+    * arena the first time it is seen.
+    */
+    Id intern(std::string_view name);
+
+    /*
+    * Returns the id of the name formed by joining scope and name with
+    * sep, e.g. function scoped labels (Main.fib$IF_TRUE). The joined
+    * text is built only once per (scope, sep, name).
+    */
+    Id qualify(Id scope, char sep, Id name);
+
+    /*
+    * Same as above but joins an index, used for static variables (Main.3).
+    */
+    Id qualify(Id scope, char sep, int index);
+
+    /*
+    * Returns the text of an interned symbol. The view stays valid
+    * for the lifetime of the table.
+    */
+    inline std::string_view operator[](Id id) const { return mNames[id]; }
+
+    /*
+    * Returns the number of distinct symbols interned so far.
+    */
+    inline std::size_t size() const { return mNames.size(); }
+
+private:
+    struct QualKey
+    {
+        Id scope;
+        std::uint32_t name;
+        char sep;
+        bool indexed;
+
+        bool operator==(const QualKey& o) const
+        {
+            return scope == o.scope && name == o.name && sep == o.sep && indexed == o.indexed;
+        }
+    };
+
+    struct QualKeyHash
+    {
+        std::size_t operator()(const QualKey& k) const
+        {
+            std::uint64_t h{ (std::uint64_t{ k.scope } << 32) | k.name };
+            h ^= (std::uint64_t{ static_cast<unsigned char>(k.sep) } << 1) | k.indexed;
+            return std::hash<std::uint64_t>{}(h * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    static constexpr std::size_t BLOCK_SIZE = 16 * 1024;
+
+    /*
+    * Character blocks holding the text of every symbol. Blocks are never
+    * moved or freed so views into them stay valid.
+    */
+    std::vector<std::unique_ptr<char[]>> mBlocks;
+    std::size_t mBlockUsed;
+    std::size_t mBlockCapacity;
+
+    std::vector<std::string_view> mNames;
+    std::unordered_map<std::string_view, Id> mIndex;
+    std::unordered_map<QualKey, Id, QualKeyHash> mQualified;
+
+    /*
+    * Scratch buffer used to join qualified names before interning.
+    */
+    std::string mScratch;
+
+    std::string_view store(std::string_view name);
+};
+
+#endif // SYMBOLTABLE_H_INCLUDED
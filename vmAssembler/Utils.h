@@ -2,7 +2,10 @@
 #define UTILS_H_INCLUDED
 
 #include <string>
+#include <string_view>
+#include <functional>
 #include <map>
+#include <memory_resource>
 
 #include "Parser.h"
 
@@ -11,10 +14,24 @@ namespace utils
     // trim from both ends (in place)
     void trim(std::string& s);
     void removeComments(std::string& s);
+
+    // view based versions used by the Parser, nothing is copied
+    std::string_view trim(std::string_view s);
+    std::string_view removeComments(std::string_view s);
+
+    // parses an optionally signed decimal number, 0 if s is empty
+    int toInt(std::string_view s);
+
+    // false for negative indices and temp/pointer indices past the
+    // registers they map to (temp 0..7, pointer 0..1)
+    bool isValidIndex(std::string_view segment, int index);
+
+    // formats value onto the end of s without a temporary string
+    void appendInt(std::pmr::string& s, int value);
     bool isVMFile(const std::string& f);
-    extern std::map<std::string, Parser::Command> commandMap;
-    extern std::map<std::string, std::string> segmentMap;
-    extern std::map<std::string, std::string> symbolMap;
+    extern std::map<std::string, Parser::Command, std::less<>> commandMap;
+    extern std::map<std::string, std::string, std::less<>> segmentMap;
+    extern std::map<std::string, std::string, std::less<>> symbolMap;
 }
 
 #endif // UTILS_H_INCLUDED
@@ -1,11 +1,83 @@
 #ifndef VMTRANSLATOR_H_INCLUDED
 #define VMTRANSLATOR_H_INCLUDED
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
+#include "Arena.h"
 #include "CodeWriter.h"
+#include "PassManager.h"
+#include "SymbolTable.h"
 
-void translateVMFile(const std::string& name, CodeWriter& cwriter);
-void translate_VM_files(const std::string& f);
+struct TranslatorOptions
+{
+    /*
+    * Threads used to parse each .vm file, 0 uses one per core.
+    * Small files are always parsed on the calling thread.
+    */
+    unsigned parseThreads{ 1 };
 
-#endif // VMTRANSLATOR_H_INCLUDED
+    /*
+    * -Os: when the program is larger than romBudget, move cold call,
+    * comparison and return sites to shared routines until it fits.
+    */
+    bool optimizeSize{ false };
+    std::size_t romBudget{ 32768 };
+
+    /*
+    * Optimization passes to run, -O2 unless changed.
+    */
+    PassManager passes{};
+
+    /*
+    * Profile written by --run --profile-generate. Sites off its hot
+    * paths use the shared routines and hot functions are written first.
+    */
+    std::string profilePath{};
+
+    /*
+    * Where to write the program instead of next to the sources.
+    */
+    std::string outputPath{};
+
+    /*
+    * Print progress and the summary.
+    */
+    bool verbose{ true };
+};
+
+/*
+* Collects the .vm files of f, a single file or a directory, in name
+* order and sets asmName to the output name used for it. Prints what it
+* does unless verbose is false.
+*/
+std::vector<std::string> collectVMFiles(const std::string& f, std::string& asmName, bool verbose = true);
 
+/*
+* Translates one .vm file after running passes over it. The arena is
+* reset first and then backs every per file and per command allocation.
+*/
+void translateVMFile(const std::string& name, CodeWriter& cwriter, SymbolTable& symbols,
+    Arena& arena, const TranslatorOptions& options, PassManager& passes);
+
+struct TranslationStats
+{
+    std::size_t files{ 0 };
+    std::uintmax_t bytes{ 0 };
+    std::size_t romSize{ 0 };
+};
+
+/*
+* Translates the .vm file or directory f and throws on failure. files
+* is 0 when f holds no .vm file. Everything it uses is its own, so
+* programs can be translated on several threads at once.
+*/
+TranslationStats translateProgram(const std::string& f, const TranslatorOptions& options);
+
+/*
+* Translates the .vm file or directory f, returns false on failure.
+*/
+bool translate_VM_files(const std::string& f, const TranslatorOptions& options = {});
+
+#endif // VMTRANSLATOR_H_INCLUDED
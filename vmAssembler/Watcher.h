@@ -0,0 +1,89 @@
+#ifndef WATCHER_H_INCLUDED
+#define WATCHER_H_INCLUDED
+
+#include <cstddef>
+#include <filesystem>
+#include <map>
+#include <sstream>
+#include <string>
+
+#include "Arena.h"
+#include "CodeWriter.h"
+#include "PassManager.h"
+#include "SymbolTable.h"
+#include "VMTranslator.h"
+
+/*
+* Keeps a program translated while its sources are edited. Every .vm
+* file is translated into its own fragment of text, kept in memory with
+* the modification time it was made from, and the .asm is put together
+* from the bootstrap and the fragments. A poll only retranslates the
+* files that changed, the symbol table and arena stay warm in between.
+* Modification times are polled as the portable way to watch files,
+* so a second edit within one tick of the file system clock is missed
+* until the file changes again. -Os is ignored as its planning needs
+* the whole program.
+*/
+class Watcher
+{
+public:
+    Watcher(const std::string& path, const TranslatorOptions& options);
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    /*
+    * Retranslates the files added or modified since the last poll,
+    * forgets removed ones and rewrites the .asm when anything changed.
+    * Returns the number of files that were retranslated.
+    */
+    std::size_t poll();
+
+    /*
+    * Words of the program as last written.
+    */
+    std::size_t romSize() const;
+
+    inline const std::string& outputName() const { return mAsmName; }
+
+private:
+    struct Fragment
+    {
+        std::filesystem::file_time_type time;
+        std::string text;
+        std::size_t romSize;
+    };
+
+    std::string mPath;
+    TranslatorOptions mOptions;
+
+    SymbolTable mSymbols;
+    Arena mArena;
+    PassManager mPasses;
+
+    std::stringbuf mBootstrap;
+    std::size_t mBootstrapSize;
+    CodeWriter mWriter;
+
+    std::string mAsmName;
+
+    /*
+    * By file name, the order the fragments are written in.
+    */
+    std::map<std::string, Fragment> mFragments;
+
+    /*
+    * Modification times of the files whose last translation failed.
+    */
+    std::map<std::string, std::filesystem::file_time_type> mFailed;
+
+    void writeOutput() const;
+};
+
+/*
+* Watches the .vm file or directory f and keeps its .asm up to date
+* until the process is stopped.
+*/
+void watch_VM_files(const std::string& f, const TranslatorOptions& options);
+
+#endif // WATCHER_H_INCLUDED
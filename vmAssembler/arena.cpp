@@ -0,0 +1,47 @@
+
+#include <algorithm>
+
+#include "Arena.h"
+
+
+Arena::Arena(std::size_t initialSize)
+    : mBuffer{ new std::byte[initialSize] }
+    , mCapacity{ initialSize }
+    , mResource{}
+    , mUsed{ 0 }
+    , mPeak{ 0 }
+{
+    mResource.emplace(mBuffer.get(), mCapacity, std::pmr::new_delete_resource());
+}
+
+void Arena::reset()
+{
+    mResource.reset();
+
+    // Leave room for alignment padding, which used() does not count
+    if (mUsed + mUsed / 8 > mCapacity)
+    {
+        mCapacity = std::max(mCapacity * 2, mUsed + mUsed / 4);
+        mBuffer.reset(new std::byte[mCapacity]);
+    }
+
+    mResource.emplace(mBuffer.get(), mCapacity, std::pmr::new_delete_resource());
+    mUsed = 0;
+}
+
+void* Arena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    mUsed += bytes;
+    mPeak = std::max(mPeak, mUsed);
+    return mResource->allocate(bytes, alignment);
+}
+
+void Arena::do_deallocate(void*, std::size_t, std::size_t)
+{
+    // Monotonic, memory comes back on reset()
+}
+
+bool Arena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
@@ -0,0 +1,220 @@
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "Batch.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    struct Result
+    {
+        TranslationStats stats{};
+        std::chrono::steady_clock::duration time{};
+        std::string error{};
+    };
+
+    std::vector<std::string> readManifest(const std::string& manifest)
+    {
+        std::ifstream in{ manifest };
+        if (!in)
+            throw std::runtime_error{ "Could not open manifest " + manifest };
+
+        const fs::path base{ fs::absolute(manifest).parent_path() };
+        std::vector<std::string> programs{};
+        std::string line{};
+        while (std::getline(in, line))
+        {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (!line.empty() && line.front() != '#')
+                programs.push_back((base / line).string());
+        }
+        return programs;
+    }
+
+    /*
+    * Runs job(0) to job(count - 1) on threads workers. The jobs are dealt
+    * out round robin, each worker takes from the back of its own queue
+    * and once that is empty steals from the front of the others, so a
+    * few large programs do not leave the other threads idle. Returns
+    * the number of jobs stolen.
+    */
+    template <typename Job>
+    std::size_t runWorkStealing(std::size_t count, unsigned threads, Job job)
+    {
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<std::size_t> jobs;
+        };
+
+        std::vector<Queue> queues(threads);
+        for (std::size_t i = 0; i < count; ++i)
+            queues[i % threads].jobs.push_back(i);
+        std::atomic<std::size_t> stolen{ 0 };
+
+        // No job adds others, so a worker that finds every queue
+        // empty is done
+        auto take{ [&](unsigned self, std::size_t& next) {
+            for (unsigned k = 0; k < threads; ++k)
+            {
+                Queue& queue{ queues[(self + k) % threads] };
+                std::lock_guard<std::mutex> lock{ queue.mutex };
+                if (queue.jobs.empty())
+                    continue;
+
+                if (k == 0)
+                {
+                    next = queue.jobs.back();
+                    queue.jobs.pop_back();
+                }
+                else
+                {
+                    next = queue.jobs.front();
+                    queue.jobs.pop_front();
+                    ++stolen;
+                }
+                return true;
+            }
+            return false;
+        } };
+
+        auto worker{ [&](unsigned self) {
+            std::size_t next{ 0 };
+            while (take(self, next))
+                job(next);
+        } };
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; ++t)
+            pool.emplace_back(worker, t);
+        worker(0);
+        for (auto& t : pool)
+            t.join();
+        return stolen;
+    }
+
+    double toMs(std::chrono::steady_clock::duration time)
+    {
+        return std::chrono::duration<double, std::milli>(time).count();
+    }
+}
+
+bool batch_translate(const std::vector<std::string>& programs, const std::string& manifest,
+    const TranslatorOptions& options, unsigned jobs)
+{
+    std::vector<std::string> all{ programs };
+    try
+    {
+        if (!manifest.empty())
+        {
+            const std::vector<std::string> listed{ readManifest(manifest) };
+            all.insert(all.end(), listed.begin(), listed.end());
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << '\n';
+        return false;
+    }
+
+    // A program listed twice, whatever the spelling of its path, would
+    // have two workers writing the same .asm
+    std::set<fs::path> seen{};
+    all.erase(std::remove_if(all.begin(), all.end(), [&](const std::string& program) {
+        std::error_code error{};
+        fs::path key{ fs::weakly_canonical(program, error) };
+        if (error)
+            key = fs::absolute(program);
+        if (!key.has_filename())
+            key = key.parent_path();
+        if (seen.insert(key).second)
+            return false;
+        std::cout << "Skipping " << program << ", listed before" << '\n';
+        return true;
+    }), all.end());
+
+    if (all.empty())
+    {
+        std::cout << "No programs to translate" << '\n';
+        return false;
+    }
+
+    // Every program is written next to its own sources
+    TranslatorOptions programOptions{ options };
+    programOptions.outputPath.clear();
+    programOptions.verbose = false;
+
+    if (jobs == 0)
+        jobs = std::max(1u, std::thread::hardware_concurrency());
+    const unsigned threads{ static_cast<unsigned>(std::min<std::size_t>(jobs, all.size())) };
+
+    std::vector<Result> results(all.size());
+    const auto start{ std::chrono::steady_clock::now() };
+
+    const std::size_t stolen{ runWorkStealing(all.size(), threads, [&](std::size_t i) {
+        Result& result{ results[i] };
+        const auto begin{ std::chrono::steady_clock::now() };
+        try
+        {
+            result.stats = translateProgram(all[i], programOptions);
+            if (result.stats.files == 0)
+                result.error = "no .vm files";
+        }
+        catch (const std::exception& e)
+        {
+            result.error = e.what();
+        }
+        result.time = std::chrono::steady_clock::now() - begin;
+        }) };
+
+    const double wallMs{ toMs(std::chrono::steady_clock::now() - start) };
+
+    std::size_t failed{ 0 }, files{ 0 }, words{ 0 };
+    std::uintmax_t bytes{ 0 };
+    std::chrono::steady_clock::duration busy{};
+
+    for (std::size_t i = 0; i < all.size(); ++i)
+    {
+        const Result& result{ results[i] };
+        busy += result.time;
+        if (!result.error.empty())
+        {
+            ++failed;
+            std::cout << "FAIL " << all[i] << ": " << result.error << '\n';
+            continue;
+        }
+
+        files += result.stats.files;
+        bytes += result.stats.bytes;
+        words += result.stats.romSize;
+        std::cout << "ok   " << all[i] << ": " << result.stats.files << " files, "
+            << result.stats.romSize << " words, " << std::fixed << std::setprecision(3)
+            << toMs(result.time) << " ms" << '\n';
+    }
+
+    const double seconds{ wallMs / 1000.0 };
+    std::cout << '\n' << "Translated " << all.size() - failed << " of " << all.size() << " programs";
+    if (failed)
+        std::cout << " (" << failed << " failed)";
+    std::cout << " in " << std::fixed << std::setprecision(3) << wallMs << " ms on " << threads << " threads" << '\n'
+        << "  " << files << " files, " << bytes << " bytes of VM code, " << words << " words of ROM" << '\n'
+        << "  " << std::setprecision(1) << (seconds > 0 ? static_cast<double>(all.size()) / seconds : 0.0) << " programs/s, "
+        << std::setprecision(2) << (seconds > 0 ? static_cast<double>(bytes) / 1e6 / seconds : 0.0) << " MB/s" << '\n'
+        << "  " << std::setprecision(3) << toMs(busy) << " ms busy, " << std::setprecision(2)
+        << (wallMs > 0 ? toMs(busy) / wallMs : 0.0) << "x parallel, " << stolen << " jobs stolen" << '\n';
+
+    return failed == 0;
+}
@@ -0,0 +1,124 @@
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+#include "Benchmark.h"
+#include "Scanner.h"
+#include "Utils.h"
+
+namespace
+{
+    // The routines the scanner replaced, kept as the reference point.
+    namespace reference
+    {
+        void ltrim(std::string& s)
+        {
+            s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
+                return !std::isspace(ch);
+                }));
+        }
+
+        void rtrim(std::string& s)
+        {
+            s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
+                return !std::isspace(ch);
+                }).base(), s.end());
+        }
+
+        void removeComments(std::string& s)
+        {
+            ltrim(s);
+            auto res = std::find(s.begin(), s.end(), '/');
+
+            if (res != s.end())
+                s.erase(res, s.end());
+
+            rtrim(s);
+        }
+
+        std::size_t scan(const std::string& text, std::size_t& bytes)
+        {
+            std::istringstream in{ text };
+            std::string line;
+            std::size_t lines{ 0 };
+
+            while (std::getline(in, line))
+            {
+                removeComments(line);
+                if (!line.empty())
+                {
+                    ++lines;
+                    bytes += line.size();
+                }
+            }
+            return lines;
+        }
+    }
+
+    std::size_t scan(const std::string& text, std::size_t& bytes)
+    {
+        const char* p{ text.data() };
+        const char* const end{ p + text.size() };
+        std::size_t lines{ 0 };
+
+        while (p < end)
+        {
+            const char* lineEnd{ scanner::findChar(p, end, '\n') };
+            std::string_view line{ utils::removeComments({ p, static_cast<std::size_t>(lineEnd - p) }) };
+            p = (lineEnd != end) ? lineEnd + 1 : end;
+
+            if (!line.empty())
+            {
+                ++lines;
+                bytes += line.size();
+            }
+        }
+        return lines;
+    }
+
+    template <typename Fn>
+    double timeRounds(Fn fn, int rounds, std::size_t& lines, std::size_t& bytes)
+    {
+        auto start{ std::chrono::steady_clock::now() };
+        for (int i = 0; i < rounds; ++i)
+        {
+            bytes = 0;
+            lines = fn(bytes);
+        }
+        std::chrono::duration<double> elapsed{ std::chrono::steady_clock::now() - start };
+        return elapsed.count();
+    }
+}
+
+void benchmarkScanner(const std::string& fileName, int rounds)
+{
+    std::ifstream file{ fileName, std::ios::binary };
+    if (!file)
+    {
+        std::cout << "Could not open " << fileName << '\n';
+        return;
+    }
+
+    const std::string text{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    const double mb{ static_cast<double>(text.size()) * rounds / (1024.0 * 1024.0) };
+
+    std::size_t refLines{}, refBytes{}, lines{}, bytes{};
+    const double refTime{ timeRounds([&](std::size_t& b) { return reference::scan(text, b); }, rounds, refLines, refBytes) };
+    const double simdTime{ timeRounds([&](std::size_t& b) { return scan(text, b); }, rounds, lines, bytes) };
+
+    std::cout << "Scanned " << text.size() << " bytes x " << rounds << " rounds\n";
+    std::cout << "  getline/isspace : " << mb / refTime << " MB/s (" << refLines << " lines)\n";
+    std::cout << "  scanner (" << scanner::isaName() << ") : " << mb / simdTime << " MB/s (" << lines << " lines)\n";
+    std::cout << "  speedup         : " << refTime / simdTime << "x\n";
+
+    // The reference cuts at a lone '/', the scanner only at "//"
+    if (refLines != lines || refBytes != bytes)
+        std::cout << "  note: outputs differ, the input has '/' outside of '//' comments\n";
+}
@@ -1,12 +1,15 @@
+#include <algorithm>
 #include <fstream>
 #include <string>
 #include <iostream>
 #include <filesystem>
 #include <vector>
 #include <exception>
+#include <stdexcept>
 
 #include "CodeWriter.h"
 #include "Parser.h"
+#include "SymbolTable.h"
 #include "Utils.h"
 
 namespace fs = std::filesystem;
@@ -34,14 +37,46 @@ const char* REG_THAT = "THAT";
 const char* EMPTY = "";
 
 const char* SEG_HIDDEN = "hidden";
-const char* SEG_FRAME = "frame";
 
-CodeWriter::CodeWriter(const std::string& name)
-    : mFile{ name }
-    , mName{ EMPTY }
+const char* TEMP_NAMES[]{ "R5", "R6", "R7", "R8", "R9", "R10", "R11", "R12" };
+const char* HIDDEN_NAMES[]{ "R13", "R14", "R15" };
+
+// Shared routines used by call, comparison and return sites
+const char* ROUTINE_CALL = "$$CALL";
+const char* ROUTINE_RETURN = "$$RETURN";
+const char* ROUTINE_COMPARE = "$$COMPARE_";
+const char* COMPARE_SIGNS[]{ "JEQ", "JGT", "JLT" };
+
+CodeWriter::CodeWriter(const std::string& name, SymbolTable& symbols, std::streambuf* buffer)
+    : mFileBuf{}
+    , mFile{ buffer }
+    , mSymbols{ symbols }
+    , mPath{ name }
+    , mName{ symbols.intern(EMPTY) }
+    , currFunctionName{ mName }
+    , mRomSize{ 0 }
+    , mLayout{}
+    , mLabelAddress{}
+    , mLabelScope{ 1 }
+    , mPlan{}
+    , mCallSites{ 0 }
+    , mComparisonSites{ 0 }
+    , mReturnSites{ 0 }
+    , mUseCallRoutine{ false }
+    , mUseReturnRoutine{ false }
+    , mUseCompareRoutine{ false, false, false }
+    , mCollectFunctions{ false }
+    , mFunctionText{}
+    , mCollectTarget{ nullptr }
+    , mRetCounter{ 0 }
+    , mCompCounter{ 0 }
 {
-    if (!mFile)
-        throw std::exception{ "Could not open file." };
+    if (!buffer)
+    {
+        if (!mFileBuf.open(name, std::ios::out | std::ios::trunc))
+            throw std::exception{ "Could not open file." };
+        mFile.rdbuf(&mFileBuf);
+    }
     init();
 
 }
@@ -49,39 +84,69 @@ CodeWriter::CodeWriter(const std::string& name)
 
 void CodeWriter::init()
 {
+    mName = mSymbols.intern("bootstrap");
+    mLayout.functions.push_back({ mSymbols.intern("(bootstrap)"), 0, 0 });
     wrtBaseCmd(256, REG_D, REG_A);
     wrtBaseCmd(REG_SP, REG_M, REG_D);
     //wrtBaseCmd("Sys.init", ZERO, "JMP");
-    writeCall("Sys.init", 0);
+    writeCall(mSymbols.intern("Sys.init"), 0);
 }
 
-void CodeWriter::writeArithmetic(const std::string& cmd)
+void CodeWriter::writeArithmetic(std::string_view cmd)
 {
-    const Parser::Command cmdType{ utils::commandMap[cmd] };
-    
+    auto type{ utils::commandMap.find(cmd) };
+    auto symbol{ utils::symbolMap.find(cmd) };
+    if (type == utils::commandMap.end() || symbol == utils::symbolMap.end())
+        return;
+
+    const Parser::Command cmdType{ type->second };
+
     if (cmdType == Parser::Command::C_ARITHMETIC_BI)
     {
         writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 1);
         writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 0, true);
-        implementArith(utils::symbolMap[cmd]);
+        implementArith(symbol->second);
         writePushPop(Parser::Command::C_PUSH, SEG_HIDDEN, 0, true);
     }
     else if (cmdType == Parser::Command::C_ARITHMETIC_UN)
     {
         writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 0, true);
-        implementArith(utils::symbolMap[cmd], false);
+        implementArith(symbol->second, false);
         writePushPop(Parser::Command::C_PUSH, SEG_HIDDEN, 0, true);
     }
     else if (cmdType == Parser::Command::C_COMPARISON)
     {
-        writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 1);
-        writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 0, true);
-        implementArith("-", true, utils::symbolMap[cmd]);
-        writePushPop(Parser::Command::C_PUSH, SEG_HIDDEN, 0, true);
+        const std::size_t start{ mRomSize };
+        const bool shared{ isShared(mPlan.sharedComparisons, mComparisonSites++) };
+        const int variant{ static_cast<int>(std::find(std::begin(COMPARE_SIGNS), std::end(COMPARE_SIGNS),
+            symbol->second) - std::begin(COMPARE_SIGNS)) };
+
+        if (shared)
+        {
+            // D = return address, the routine pops both operands
+            // and pushes the result
+            const int n{ mCompCounter++ };
+            mFile << AT << "RET_COMP_" << symbol->second << '_' << mSymbols[mName] << '.' << n << '\n';
+            ++mRomSize;
+            wrtBaseCmd(EMPTY, REG_D, REG_A, false);
+            mFile << AT << ROUTINE_COMPARE << symbol->second << '\n';
+            ++mRomSize;
+            wrtBaseCmd(EMPTY, ZERO, "JMP", false);
+            mFile << BRAC_OP << "RET_COMP_" << symbol->second << '_' << mSymbols[mName] << '.' << n << BRAC_CLE << '\n';
+            mUseCompareRoutine[variant] = true;
+        }
+        else
+        {
+            writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 1);
+            writePushPop(Parser::Command::C_POP, SEG_HIDDEN, 0, true);
+            implementArith("-", true, symbol->second);
+            writePushPop(Parser::Command::C_PUSH, SEG_HIDDEN, 0, true);
+        }
+        recordSite(SiteKind::COMPARISON, start, shared, 4, variant);
     }
 }
 
-void CodeWriter::writePushPop(Parser::Command cmd, const std::string& segment, int index, bool ld_frm_d)
+void CodeWriter::writePushPop(Parser::Command cmd, std::string_view segment, int index, bool ld_frm_d)
 {
     auto found{ utils::segmentMap.find(segment) };
 
@@ -108,10 +173,7 @@ void CodeWriter::writePushPop(Parser::Command cmd, const std::string& segment, i
             wrtBaseCmd(EMPTY, REG_D, REG_M, false);
 
             if (!ld_frm_d)
-            {
-                std::string temp{ directQualName(index, segment) };
-                wrtBaseCmd(temp, REG_M, REG_D);
-            }
+                wrtBaseCmd(directQualName(index, segment), REG_M, REG_D);
         }
     }
     else if (cmd == Parser::Command::C_PUSH)
@@ -124,7 +186,7 @@ void CodeWriter::writePushPop(Parser::Command cmd, const std::string& segment, i
         }
         else if (!ld_frm_d)
         {
-            std::string temp{ directQualName(index, segment) };
+            std::string_view temp{ directQualName(index, segment) };
 
             if (segment == "constant")
                 wrtBaseCmd(index, REG_D, REG_A);
@@ -141,11 +203,66 @@ void CodeWriter::writePushPop(Parser::Command cmd, const std::string& segment, i
     }
 }
 
-void CodeWriter::close() { mFile.close(); }
+void CodeWriter::writeArrayRead(bool setThat)
+{
+    // D = index, A -> base
+    wrtRaw("@SP");
+    wrtRaw("AM=M-1");
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    wrtBaseCmd(EMPTY, REG_A, REG_A, MINUS, '1', false);
+    if (setThat)
+    {
+        wrtBaseCmd(EMPTY, REG_D, REG_D, PLUS, REG_M, false);
+        wrtRaw("@THAT");
+        wrtRaw("AM=D");
+    }
+    else
+        wrtBaseCmd(EMPTY, REG_A, REG_D, PLUS, REG_M, false);
+
+    // Element replaces the base on the stack
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+    wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+}
+
+void CodeWriter::writeArrayWrite(bool setThat, bool setTemp)
+{
+    // D = value, stored through the address below it
+    wrtRaw("@SP");
+    wrtRaw("AM=M-1");
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    if (setTemp)
+    {
+        wrtBaseCmd(TEMP_NAMES[0], REG_M, REG_D);
+        wrtBaseCmd(REG_SP, REG_A, REG_M);
+    }
+    wrtBaseCmd(EMPTY, REG_A, REG_A, MINUS, '1', false);
+    wrtBaseCmd(EMPTY, REG_A, REG_M, false);
+    wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+
+    if (setThat)
+    {
+        wrtRaw("@SP");
+        wrtRaw("AM=M-1");
+        wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+        wrtBaseCmd(REG_THAT, REG_M, REG_D);
+    }
+    else
+        wrtBaseCmd(REG_SP, REG_M, REG_M, MINUS, '1');
+}
+
+void CodeWriter::close() { mFileBuf.close(); }
+
+void CodeWriter::setOutput(std::streambuf* buffer)
+{
+    mFile.flush();
+    mFile.rdbuf(buffer ? buffer : &mFileBuf);
+}
 
 // Beginning of overloaded functions for generating Hack assembly commands.
-void CodeWriter::wrtBaseCmd(const std::string& seg, char to, char from, bool ld_seg)
+void CodeWriter::wrtBaseCmd(std::string_view seg, char to, char from, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << seg << '\n';
     mFile << to << EQUALS_TO << from << '\n';
@@ -153,6 +270,7 @@ void CodeWriter::wrtBaseCmd(const std::string& seg, char to, char from, bool ld_
 
 void CodeWriter::wrtBaseCmd(int seg, char to, char op1, char op, char op2, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << seg << '\n';
     mFile << to << EQUALS_TO << op1 << op << op2 << '\n';
@@ -160,26 +278,30 @@ void CodeWriter::wrtBaseCmd(int seg, char to, char op1, char op, char op2, bool
 
 void CodeWriter::wrtBaseCmd(int segment, char to, char from, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << segment << '\n';
     mFile << to << EQUALS_TO << from << '\n';
 }
-void CodeWriter::wrtBaseCmd(const std::string& seg, char to, char op1, char op, char op2, bool ld_seg)
+void CodeWriter::wrtBaseCmd(std::string_view seg, char to, char op1, char op, char op2, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << seg << '\n';
     mFile << to << EQUALS_TO << op1 << op << op2 << '\n';
 }
 
-void CodeWriter::wrtBaseCmd(const std::string& seg, char comp_val, const std::string& comp_op, bool ld_seg)
+void CodeWriter::wrtBaseCmd(std::string_view seg, char comp_val, std::string_view comp_op, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << seg << '\n';
     mFile << comp_val << ';' << comp_op << '\n';
 }
 
-void CodeWriter::wrtBaseCmd(const std::string& seg, char to, char op, char op1, bool ld_seg)
+void CodeWriter::wrtBaseCmd(std::string_view seg, char to, char op, char op1, bool ld_seg)
 {
+    mRomSize += ld_seg ? 2 : 1;
     if (ld_seg)
         mFile << AT << seg << '\n';
     mFile << to << EQUALS_TO << op << op1 << '\n';
@@ -187,7 +309,7 @@ void CodeWriter::wrtBaseCmd(const std::string& seg, char to, char op, char op1,
 // end of overloaded functions
 
 
-void CodeWriter::accessIdxAddrOrLdMem(int index, const std::string& seg)
+void CodeWriter::accessIdxAddrOrLdMem(int index, std::string_view seg)
 {
     if (!index)
         wrtBaseCmd(seg, REG_D, REG_M);
@@ -198,10 +320,9 @@ void CodeWriter::accessIdxAddrOrLdMem(int index, const std::string& seg)
     }
 }
 
-void CodeWriter::implementArith(const std::string& sign, bool binary_op, const std::string& cmp_sign)
+void CodeWriter::implementArith(std::string_view sign, bool binary_op, std::string_view cmp_sign)
 {
-    static int comp_sign_counter{};
-    std::string r13{ REG_R13 };
+    int& comp_sign_counter{ mCompCounter };
 
     if (binary_op)
         wrtBaseCmd(REG_R14, REG_D, REG_D, sign.front(), REG_M);
@@ -210,42 +331,47 @@ void CodeWriter::implementArith(const std::string& sign, bool binary_op, const s
 
     if (!cmp_sign.empty())
     {
-        std::string compLabel{ "COMP_" + cmp_sign + "_" + std::to_string(comp_sign_counter) };
-        std::string exitCompLabel{ "EXIT_" + compLabel };
-
-        wrtBaseCmd(compLabel, REG_D, cmp_sign);
+        // COMP_<sign>_<file>.<n> and EXIT_COMP_<sign>_<file>.<n> are formatted straight
+        // into the output stream, they are never referenced again.
+        mFile << AT << "COMP_" << cmp_sign << '_' << mSymbols[mName] << '.' << comp_sign_counter << '\n';
+        ++mRomSize;
+        wrtBaseCmd(EMPTY, REG_D, cmp_sign, false);
 
-        wrtBaseCmd(r13, REG_D, ZERO);
+        wrtBaseCmd(REG_R13, REG_D, ZERO);
 
-        wrtBaseCmd(exitCompLabel, ZERO, "JMP");
+        mFile << AT << "EXIT_COMP_" << cmp_sign << '_' << mSymbols[mName] << '.' << comp_sign_counter << '\n';
+        ++mRomSize;
+        wrtBaseCmd(EMPTY, ZERO, "JMP", false);
 
-        mFile << BRAC_OP << compLabel << BRAC_CLE << '\n';
-        wrtBaseCmd(r13, REG_D, MINUS, '1');
-        mFile << BRAC_OP << exitCompLabel << BRAC_CLE << '\n';
+        mFile << BRAC_OP << "COMP_" << cmp_sign << '_' << mSymbols[mName] << '.' << comp_sign_counter << BRAC_CLE << '\n';
+        wrtBaseCmd(REG_R13, REG_D, MINUS, '1');
+        mFile << BRAC_OP << "EXIT_COMP_" << cmp_sign << '_' << mSymbols[mName] << '.' << comp_sign_counter << BRAC_CLE << '\n';
 
         comp_sign_counter++;
     }
 }
 
-std::string CodeWriter::directQualName(int index, const std::string& segment)
+std::string_view CodeWriter::directQualName(int index, std::string_view segment)
 {
-    std::string temp;
+    // The Parser rejects these, commands made up by passes must too
+    if (!utils::isValidIndex(segment, index) || (segment == SEG_HIDDEN && index > 2))
+        throw std::runtime_error{ std::string{ segment } + " " + std::to_string(index) + " is out of range" };
+
     if (segment == "temp")
-        temp = { 'R' + std::to_string(5 + index) };
+        return TEMP_NAMES[index];
     else if (segment == "static")
-        temp = { mName + '.' + std::to_string(index) };
+        return mSymbols[mSymbols.qualify(mName, '.', index)];
     else if (segment == "pointer")
-        temp = (index) ? REG_THAT : REG_THIS;
+        return (index) ? REG_THAT : REG_THIS;
     else if (segment == SEG_HIDDEN)
-        temp = { 'R' + std::to_string(13 + index) };
+        return HIDDEN_NAMES[index];
     else
-        temp = {};
-    return temp;
+        return {};
 }
 
-void CodeWriter::opt_assignment_op(int const_val, const std::string& seg, int index)
+void CodeWriter::opt_assignment_op(int const_val, std::string_view seg, int index)
 {
-    std::string tempName{ directQualName(index, seg) };
+    std::string_view tempName{ directQualName(index, seg) };
     auto found{ utils::segmentMap.find(seg) };
 
     if (found != utils::segmentMap.end() && index != 0)
@@ -269,36 +395,67 @@ void CodeWriter::opt_assignment_op(int const_val, const std::string& seg, int in
     wrtBaseCmd(EMPTY, REG_M, REG_D, false);
 }
 
-std::string CodeWriter::__gen_label_name(const std::string& label, bool add_prefix)
+std::string_view CodeWriter::__gen_label_name(SymbolTable::Id label, bool add_prefix)
 {
-    return (add_prefix) ? std::string{currFunctionName + "$" + label} : std::string{label};
+    return mSymbols[(add_prefix) ? mSymbols.qualify(currFunctionName, '$', label) : label];
 }
 
-void CodeWriter::writeLabel(const std::string& label, bool add_prefix)
+void CodeWriter::writeLabel(SymbolTable::Id label, bool add_prefix)
 {
-    mFile << BRAC_OP << __gen_label_name(label, add_prefix) << BRAC_CLE << '\n';
+    std::string_view name{ __gen_label_name(label, add_prefix) };
+    if (add_prefix)
+    {
+        if (label >= mLabelAddress.size())
+            mLabelAddress.resize(std::max<std::size_t>(label + 1, mSymbols.size()));
+        mLabelAddress[label] = { mLabelScope, mRomSize };
+    }
+    mFile << BRAC_OP << name << BRAC_CLE << '\n';
 }
 
-void CodeWriter::writeGoto(const std::string& label, bool add_prefix)
+void CodeWriter::writeGoto(SymbolTable::Id label, bool add_prefix)
 {
+    if (add_prefix)
+        recordJump(label);
     wrtBaseCmd(__gen_label_name(label, add_prefix), ZERO, "JMP");
 }
 
-void CodeWriter::writeIf(const std::string& label, bool add_prefix)
+void CodeWriter::writeIf(SymbolTable::Id label, bool add_prefix)
 {
+    if (add_prefix)
+        recordJump(label);
     wrtBaseCmd(REG_SP, REG_M, REG_M, MINUS, '1');
     wrtBaseCmd(REG_SP, REG_A, REG_M);
     wrtBaseCmd(EMPTY, REG_D, REG_M, false);
     wrtBaseCmd(__gen_label_name(label, add_prefix), REG_D, "JNE");
 }
 
+void CodeWriter::recordJump(SymbolTable::Id label)
+{
+    if (label < mLabelAddress.size() && mLabelAddress[label].first == mLabelScope)
+        mLayout.loops.emplace_back(mLabelAddress[label].second, mRomSize);
+}
+
 void CodeWriter::setFileName(const std::string& file)
 {
-    mName = fs::path(file).filename().replace_extension().string();
+    mName = mSymbols.intern(fs::path(file).filename().replace_extension().string());
+    mRetCounter = mCompCounter = 0;
 }
 
-void CodeWriter::writeFunction(const std::string& func_name, int nVars)
+void CodeWriter::writeFunction(SymbolTable::Id func_name, int nVars)
 {
+    FunctionInfo& prev{ mLayout.functions.back() };
+    prev.size = mRomSize - prev.address;
+    mLayout.functions.push_back({ func_name, mRomSize, 0 });
+    ++mLabelScope;
+
+    if (mCollectFunctions)
+    {
+        if (mFunctionText.empty())
+            mCollectTarget = mFile.rdbuf();
+        mFunctionText.push_back({ func_name, {}, false });
+        mFile.rdbuf(&mFunctionText.back().text);
+    }
+
     currFunctionName = func_name;
     writeLabel(func_name, false);
     for (int i = 0; i < nVars; i++)
@@ -309,37 +466,250 @@ void CodeWriter::writeFunction(const std::string& func_name, int nVars)
     }
 }
 
-void CodeWriter::writeReturn()
+void CodeWriter::writeReturn(bool restoreThis, bool restoreThat)
 {
-    // Pushes LCL pointer to a temporary variable
-    wrtBaseCmd(REG_LOCAL, REG_D, REG_M);
-    wrtBaseCmd(SEG_FRAME, REG_M, REG_D);
+    const std::size_t start{ mRomSize };
+    const bool shared{ isShared(mPlan.sharedReturns, mReturnSites++) };
+
+    if (shared)
+    {
+        wrtBaseCmd(ROUTINE_RETURN, ZERO, "JMP");
+        mUseReturnRoutine = true;
+    }
+    else
+        __returnBody(restoreThis, restoreThat);
+    recordSite(SiteKind::RETURN, start, shared, 2);
+}
 
-    // Pushes return address to a temporary variable
-    __restorePointer("ret", 5);
+void CodeWriter::writeReturnConstant(int value, bool restoreThis, bool restoreThat)
+{
+    const std::size_t start{ mRomSize };
+    const bool shared{ isShared(mPlan.sharedReturns, mReturnSites++) };
+
+    // The shared routine takes the value from the stack, the site is
+    // push constant (7 words) and the jump (2)
+    if (shared)
+    {
+        writePushPop(Parser::Command::C_PUSH, "constant", value);
+        wrtBaseCmd(ROUTINE_RETURN, ZERO, "JMP");
+        mUseReturnRoutine = true;
+    }
+    else
+        __returnBody(restoreThis, restoreThat, true, value);
+    recordSite(SiteKind::RETURN, start, shared, 9);
+}
 
-    //Pops the topmost value of the stack into the caller argument
-    writePushPop(Parser::Command::C_POP, "argument", 0);
+void CodeWriter::__returnBody(bool restoreThis, bool restoreThat, bool constant, int value)
+{
+    // Return address to R14, read first as with no arguments the
+    // return value goes to the same word
+    wrtBaseCmd(REG_LOCAL, REG_D, REG_M);
+    wrtBaseCmd(5, REG_A, REG_D, MINUS, REG_A);
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    wrtBaseCmd(REG_R14, REG_M, REG_D);
+
+    // Return value to the caller's top of stack, ARG 0
+    if (constant && (value == 0 || value == 1))
+    {
+        wrtBaseCmd(REG_ARG, REG_A, REG_M);
+        wrtBaseCmd(EMPTY, REG_M, static_cast<char>('0' + value), false);
+    }
+    else
+    {
+        if (constant)
+            wrtBaseCmd(value, REG_D, REG_A);
+        else
+        {
+            wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+            wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+        }
+        wrtBaseCmd(REG_ARG, REG_A, REG_M);
+        wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+    }
 
     //Repositions stack pointer for the caller
-    wrtBaseCmd(REG_ARG, REG_D, REG_M, PLUS, '1');
+    wrtBaseCmd(EMPTY, REG_D, REG_A, PLUS, '1', false);
     wrtBaseCmd(REG_SP, REG_M, REG_D);
 
-    const char* reg_temp[]{ REG_THAT, REG_THIS, REG_ARG, REG_LOCAL };
+    // LCL is walked down the saved THAT, THIS, ARG and LCL, it is the
+    // last one restored. Pointers left alone only step over their word.
+    const char* reg_temp[]{ REG_THAT, REG_THIS, REG_ARG };
+    const bool restore[]{ restoreThat, restoreThis, true };
+    int skipped{ 0 };
 
-    for (int i = 0; i < 4; ++i)
-        __restorePointer(reg_temp[i], i + 1);
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!restore[i])
+        {
+            ++skipped;
+            continue;
+        }
+        wrtRaw("@LCL");
+        for (; skipped > 0; --skipped)
+            wrtRaw("M=M-1");
+        wrtRaw("AM=M-1");
+        wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+        wrtBaseCmd(reg_temp[i], REG_M, REG_D);
+    }
+    wrtRaw("@LCL");
+    wrtRaw("A=M-1");
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    wrtBaseCmd(REG_LOCAL, REG_M, REG_D);
 
-    wrtBaseCmd("ret", REG_A, REG_M);
+    wrtBaseCmd(REG_R14, REG_A, REG_M);
     wrtBaseCmd(EMPTY, '0', "JMP", false);
 }
 
-void CodeWriter::writeCall(const std::string& func_name, int nVars)
+std::size_t CodeWriter::multiplySize(int constant)
+{
+    // 6 words to load and store the operand, 2 per doubling, 2 per
+    // addition of x and 2 to keep x in R13 when there is an addition
+    int top{ 0 }, ones{ 0 };
+    for (int bit = 0; bit < 15; ++bit)
+    {
+        if (constant & (1 << bit))
+        {
+            top = bit;
+            ++ones;
+        }
+    }
+
+    if (constant == 0)
+        return 3;
+    if (constant == 1)
+        return 0;
+    return static_cast<std::size_t>(6 + 2 * top + 2 * (ones - 1) + (ones > 1 ? 2 : 0));
+}
+
+void CodeWriter::writeMultiply(int constant)
+{
+    if (constant == 0)
+    {
+        wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+        wrtBaseCmd(EMPTY, REG_M, ZERO, false);
+    }
+    else if (constant > 1)
+    {
+        // x * k by doubling and adding x, walking the bits of k from
+        // the top. Hack has no D+D so doubling goes through A.
+        int top{ 14 };
+        while (!(constant & (1 << top)))
+            --top;
+
+        wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+        wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+        if (constant & (constant - 1))
+            wrtBaseCmd(REG_R13, REG_M, REG_D);
+
+        for (int bit = top - 1; bit >= 0; --bit)
+        {
+            wrtBaseCmd(EMPTY, REG_A, REG_D, false);
+            wrtBaseCmd(EMPTY, REG_D, REG_D, PLUS, REG_A, false);
+            if (constant & (1 << bit))
+                wrtBaseCmd(REG_R13, REG_D, REG_D, PLUS, REG_M);
+        }
+        wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+        wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+    }
+}
+
+std::size_t CodeWriter::divideSize(int powerOfTwo)
+{
+    // 11 words to take |x| into R13 and clear R14, 8 to test bit 15
+    // by sign, 10 per other bit down to k and 12 to fix the sign and
+    // store the result
+    int k{ 0 };
+    while ((1 << k) < powerOfTwo)
+        ++k;
+    return static_cast<std::size_t>(31 + 10 * (15 - k));
+}
+
+void CodeWriter::writeDivide(int powerOfTwo)
+{
+    const int n{ mCompCounter++ };
+    int k{ 0 };
+    while ((1 << k) < powerOfTwo)
+        ++k;
+
+    // R13 = |x| as an unsigned word, R14 = |x| / 2^k. Only -32768
+    // has bit 15 set, it is tested by sign as @32768 does not exist.
+    wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    wrtBaseCmd(REG_R13, REG_M, REG_D);
+    wrtBaseCmd(REG_R14, REG_M, ZERO);
+    mFile << AT << "DIV_POS_" << mSymbols[mName] << '.' << n << '\n';
+    ++mRomSize;
+    wrtBaseCmd(EMPTY, REG_D, "JGE", false);
+    wrtBaseCmd(REG_R13, REG_M, MINUS, REG_M);
+    mFile << BRAC_OP << "DIV_POS_" << mSymbols[mName] << '.' << n << BRAC_CLE << '\n';
+
+    for (int bit = 15; bit >= k; --bit)
+    {
+        if (bit == 15)
+            wrtBaseCmd(REG_R13, REG_D, REG_M);
+        else
+        {
+            wrtBaseCmd(1 << bit, REG_D, REG_A);
+            wrtBaseCmd(REG_R13, REG_D, REG_D, '&', REG_M);
+        }
+        mFile << AT << "DIV_" << mSymbols[mName] << '.' << n << '_' << bit << '\n';
+        ++mRomSize;
+        wrtBaseCmd(EMPTY, REG_D, (bit == 15) ? "JGE" : "JEQ", false);
+        wrtBaseCmd(1 << (bit - k), REG_D, REG_A);
+        wrtBaseCmd(REG_R14, REG_M, REG_D, PLUS, REG_M);
+        mFile << BRAC_OP << "DIV_" << mSymbols[mName] << '.' << n << '_' << bit << BRAC_CLE << '\n';
+    }
+
+    wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+    wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+    mFile << AT << "DIV_END_" << mSymbols[mName] << '.' << n << '\n';
+    ++mRomSize;
+    wrtBaseCmd(EMPTY, REG_D, "JGE", false);
+    wrtBaseCmd(REG_R14, REG_M, MINUS, REG_M);
+    mFile << BRAC_OP << "DIV_END_" << mSymbols[mName] << '.' << n << BRAC_CLE << '\n';
+    wrtBaseCmd(REG_R14, REG_D, REG_M);
+    wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+    wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+}
+
+void CodeWriter::writeCall(SymbolTable::Id func_name, int nVars)
 {
-    static int retStaticVar{};
-    //Add return address to global stack
-    std::string label{ func_name + "$ret." + std::to_string(retStaticVar++) };
-    __push(label);
+    const std::size_t start{ mRomSize };
+    const bool shared{ isShared(mPlan.sharedCalls, mCallSites++) };
+
+    //Add return address to global stack. The label is unique to this call
+    //site so it is formatted at output time instead of being interned.
+    const int retIndex{ mRetCounter++ };
+
+    if (shared)
+    {
+        // R13 = nArgs, R14 = callee, D = return address
+        if (nVars != 0)
+        {
+            wrtBaseCmd(nVars, REG_D, REG_A);
+            wrtBaseCmd(REG_R13, REG_M, REG_D);
+        }
+        else
+            wrtBaseCmd(REG_R13, REG_M, ZERO);
+        wrtBaseCmd(mSymbols[func_name], REG_D, REG_A);
+        wrtBaseCmd(REG_R14, REG_M, REG_D);
+        mFile << AT << mSymbols[func_name] << "$ret." << mSymbols[mName] << '.' << retIndex << '\n';
+        ++mRomSize;
+        wrtBaseCmd(EMPTY, REG_D, REG_A, false);
+        wrtBaseCmd(ROUTINE_CALL, ZERO, "JMP");
+        mFile << BRAC_OP << mSymbols[func_name] << "$ret." << mSymbols[mName] << '.' << retIndex << BRAC_CLE << '\n';
+
+        mUseCallRoutine = true;
+        recordSite(SiteKind::CALL, start, shared, (nVars != 0) ? 12 : 10, 0, func_name);
+        return;
+    }
+
+    mFile << AT << mSymbols[func_name] << "$ret." << mSymbols[mName] << '.' << retIndex << '\n';
+    ++mRomSize;
+    wrtBaseCmd(EMPTY, REG_D, REG_A, false);
+    wrtBaseCmd(REG_SP, REG_A, REG_M);
+    wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+    wrtBaseCmd(REG_SP, REG_M, REG_M, PLUS, '1');
 
     //pushes LCL, ARG, THIS, THAT to the global stack
     const char* reg_temp[]{ REG_LOCAL, REG_ARG, REG_THIS, REG_THAT };
@@ -360,7 +730,9 @@ void CodeWriter::writeCall(const std::string& func_name, int nVars)
 
     //jump to function and add return label
     writeGoto(func_name, false);
-    writeLabel(label, false);
+    mFile << BRAC_OP << mSymbols[func_name] << "$ret." << mSymbols[mName] << '.' << retIndex << BRAC_CLE << '\n';
+
+    recordSite(SiteKind::CALL, start, shared, (nVars != 0) ? 12 : 10, 0, func_name);
 }
 
 void CodeWriter::__push(const char* segment, bool ret_addr)
@@ -375,16 +747,197 @@ void CodeWriter::__push(const char* segment, bool ret_addr)
     wrtBaseCmd(REG_SP, REG_M, REG_M, PLUS, '1');
 }
 
-void CodeWriter::__push(const std::string& segment)
+void CodeWriter::wrtRaw(std::string_view line)
+{
+    mFile << line << '\n';
+    ++mRomSize;
+}
+
+bool CodeWriter::isShared(const std::vector<bool>& plan, std::size_t ordinal) const
+{
+    return ordinal < plan.size() && plan[ordinal];
+}
+
+void CodeWriter::recordSite(SiteKind kind, std::size_t address, bool shared, std::size_t sharedSize, int variant,
+    SymbolTable::Id callee)
 {
-    __push(segment.c_str(), true);
+    mLayout.sites.push_back({ kind, mLayout.functions.size() - 1, address, mRomSize - address,
+        sharedSize, variant, shared, callee });
 }
 
-void CodeWriter::__restorePointer(const char* segment, int index)
+std::size_t CodeWriter::routineSize(SiteKind kind)
 {
-    wrtBaseCmd(index, REG_D, REG_A);
-    wrtBaseCmd(SEG_FRAME, REG_A, REG_M, MINUS, REG_D);
-    wrtBaseCmd(0, REG_D, REG_M, false);
-    wrtBaseCmd(segment, REG_M, REG_D);
+    switch (kind)
+    {
+    case SiteKind::CALL:
+        return 48;
+    case SiteKind::COMPARISON:
+        return 16;
+    case SiteKind::RETURN:
+    default:
+        return 39;
+    }
 }
 
+void CodeWriter::writeSharedRoutines()
+{
+    FunctionInfo& prev{ mLayout.functions.back() };
+    prev.size = mRomSize - prev.address;
+    mLayout.functions.push_back({ mSymbols.intern("(shared routines)"), mRomSize, 0 });
+
+    if (mUseCallRoutine)
+    {
+        // D = return address, R13 = nArgs, R14 = callee
+        mFile << BRAC_OP << ROUTINE_CALL << BRAC_CLE << '\n';
+        wrtBaseCmd(REG_SP, REG_A, REG_M);
+        wrtBaseCmd(EMPTY, REG_M, REG_D, false);
+        wrtBaseCmd(REG_SP, REG_M, REG_M, PLUS, '1');
+
+        const char* reg_temp[]{ REG_LOCAL, REG_ARG, REG_THIS, REG_THAT };
+        for (int i = 0; i < 4; ++i)
+            __push(reg_temp[i]);
+
+        wrtBaseCmd(REG_R13, REG_D, REG_M);
+        wrtBaseCmd(5, REG_D, REG_D, PLUS, REG_A);
+        wrtBaseCmd(REG_SP, REG_D, REG_M, MINUS, REG_D);
+        wrtBaseCmd(REG_ARG, REG_M, REG_D);
+        wrtBaseCmd(REG_SP, REG_D, REG_M);
+        wrtBaseCmd(REG_LOCAL, REG_M, REG_D);
+        wrtBaseCmd(REG_R14, REG_A, REG_M);
+        wrtBaseCmd(EMPTY, ZERO, "JMP", false);
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        if (!mUseCompareRoutine[i])
+            continue;
+
+        // D = return address, kept in R15 while the operands are compared
+        const char* sign{ COMPARE_SIGNS[i] };
+        mFile << BRAC_OP << ROUTINE_COMPARE << sign << BRAC_CLE << '\n';
+        wrtBaseCmd(HIDDEN_NAMES[2], REG_M, REG_D);
+        wrtRaw("@SP");
+        wrtRaw("AM=M-1");
+        wrtBaseCmd(EMPTY, REG_D, REG_M, false);
+        wrtBaseCmd(EMPTY, REG_A, REG_A, MINUS, '1', false);
+        wrtBaseCmd(EMPTY, REG_D, REG_M, MINUS, REG_D, false);
+        wrtBaseCmd(EMPTY, REG_M, MINUS, '1', false);
+        mFile << AT << ROUTINE_COMPARE << sign << "_END" << '\n';
+        ++mRomSize;
+        wrtBaseCmd(EMPTY, REG_D, sign, false);
+        wrtBaseCmd(REG_SP, REG_A, REG_M, MINUS, '1');
+        wrtBaseCmd(EMPTY, REG_M, ZERO, false);
+        mFile << BRAC_OP << ROUTINE_COMPARE << sign << "_END" << BRAC_CLE << '\n';
+        wrtBaseCmd(HIDDEN_NAMES[2], REG_A, REG_M);
+        wrtBaseCmd(EMPTY, ZERO, "JMP", false);
+    }
+
+    if (mUseReturnRoutine)
+    {
+        mFile << BRAC_OP << ROUTINE_RETURN << BRAC_CLE << '\n';
+        __returnBody(true, true);
+    }
+
+    mLayout.functions.back().size = mRomSize - mLayout.functions.back().address;
+}
+
+void CodeWriter::collectFunctions(bool collect)
+{
+    mCollectFunctions = collect;
+}
+
+void CodeWriter::writeFunctions(const std::vector<SymbolTable::Id>& first)
+{
+    if (mFunctionText.empty())
+        return;
+    mFile.rdbuf(mCollectTarget);
+
+    std::unordered_map<SymbolTable::Id, FunctionText*> byName{};
+    for (auto& function : mFunctionText)
+        byName.emplace(function.name, &function);
+
+    auto write{ [this](FunctionText& function) {
+        if (!function.written)
+            mFile << function.text.str();
+        function.written = true;
+    } };
+
+    for (SymbolTable::Id name : first)
+    {
+        auto found{ byName.find(name) };
+        if (found != byName.end())
+            write(*found->second);
+    }
+    for (auto& function : mFunctionText)
+        write(function);
+    mFunctionText.clear();
+}
+
+void CodeWriter::restart(const SizePlan& plan)
+{
+    mFileBuf.close();
+    if (!mFileBuf.open(mPath, std::ios::out | std::ios::trunc))
+        throw std::runtime_error{ "Could not reopen " + mPath };
+    mFile.rdbuf(&mFileBuf);
+
+    mPlan = plan;
+    mRomSize = 0;
+    clearLayout();
+    mCallSites = mComparisonSites = mReturnSites = 0;
+    mUseCallRoutine = mUseReturnRoutine = false;
+    std::fill(std::begin(mUseCompareRoutine), std::end(mUseCompareRoutine), false);
+    mRetCounter = mCompCounter = 0;
+    mFunctionText.clear();
+    currFunctionName = mSymbols.intern(EMPTY);
+
+    init();
+}
+
+void CodeWriter::startFragment()
+{
+    clearLayout();
+    mLayout.functions.push_back({ mSymbols.intern("(fragment)"), mRomSize, 0 });
+}
+
+void CodeWriter::reserveLayout(const std::pmr::vector<Parser::Instruction>& code)
+{
+    std::size_t sites{ 0 }, functions{ 0 }, jumps{ 0 };
+    for (const auto& instr : code)
+    {
+        switch (instr.type)
+        {
+        case Parser::Command::C_CALL:
+        case Parser::Command::C_COMPARISON:
+        case Parser::Command::C_RETURN:
+            ++sites;
+            break;
+        case Parser::Command::C_FUNCTION:
+            ++functions;
+            break;
+        case Parser::Command::C_GOTO:
+        case Parser::Command::C_IF:
+            ++jumps;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Doubling at least, so a program of many files grows each vector
+    // a logarithmic number of times
+    auto grow{ [](auto& v, std::size_t more) {
+        if (v.size() + more > v.capacity())
+            v.reserve(std::max(v.size() + more, 2 * v.capacity()));
+        } };
+    grow(mLayout.sites, sites);
+    grow(mLayout.functions, functions + 1);
+    grow(mLayout.loops, jumps);
+}
+
+void CodeWriter::clearLayout()
+{
+    mLayout.sites.clear();
+    mLayout.functions.clear();
+    mLayout.loops.clear();
+    ++mLabelScope;
+}
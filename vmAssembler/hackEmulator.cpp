@@ -0,0 +1,201 @@
+
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+#include "HackEmulator.h"
+#include "Utils.h"
+
+namespace
+{
+    constexpr std::uint8_t DEST_M = 1;
+    constexpr std::uint8_t DEST_D = 2;
+    constexpr std::uint8_t DEST_A = 4;
+    constexpr std::uint8_t COMP_A_BIT = 0x40;
+
+    /*
+    * zx nx zy ny f no of each computation with A, the M forms are the
+    * same with the a bit set.
+    */
+    const std::unordered_map<std::string_view, std::uint8_t> COMPUTATIONS{
+        { "0", 0x2A }, { "1", 0x3F }, { "-1", 0x3A }, { "D", 0x0C }, { "A", 0x30 },
+        { "!D", 0x0D }, { "!A", 0x31 }, { "-D", 0x0F }, { "-A", 0x33 }, { "D+1", 0x1F },
+        { "A+1", 0x37 }, { "D-1", 0x0E }, { "A-1", 0x32 }, { "D+A", 0x02 }, { "A+D", 0x02 },
+        { "D-A", 0x13 }, { "A-D", 0x07 }, { "D&A", 0x00 }, { "A&D", 0x00 }, { "D|A", 0x15 },
+        { "A|D", 0x15 },
+    };
+
+    const std::unordered_map<std::string_view, std::uint8_t> JUMPS{
+        { "JGT", 1 }, { "JEQ", 2 }, { "JGE", 3 }, { "JLT", 4 }, { "JNE", 5 }, { "JLE", 6 }, { "JMP", 7 },
+    };
+
+    const std::unordered_map<std::string, std::uint16_t> PREDEFINED{
+        { "SP", 0 }, { "LCL", 1 }, { "ARG", 2 }, { "THIS", 3 }, { "THAT", 4 },
+        { "R0", 0 }, { "R1", 1 }, { "R2", 2 }, { "R3", 3 }, { "R4", 4 }, { "R5", 5 },
+        { "R6", 6 }, { "R7", 7 }, { "R8", 8 }, { "R9", 9 }, { "R10", 10 }, { "R11", 11 },
+        { "R12", 12 }, { "R13", 13 }, { "R14", 14 }, { "R15", 15 },
+        { "SCREEN", 16384 }, { "KBD", 24576 },
+    };
+
+    /*
+    * Strips comments and every space, Hack instructions have none.
+    */
+    std::string clean(const std::string& line)
+    {
+        std::string out{};
+        for (char c : utils::removeComments(std::string_view{ line }))
+        {
+            if (c != ' ' && c != '\t' && c != '\r')
+                out.push_back(c);
+        }
+        return out;
+    }
+
+    bool isNumber(std::string_view s)
+    {
+        return !s.empty() && s.find_first_not_of("0123456789") == std::string_view::npos;
+    }
+}
+
+HackEmulator::HackEmulator(const std::string& fileName)
+    : mRom{}
+    , mRam(RAM_SIZE)
+    , mVariables{}
+    , mA{ 0 }
+    , mD{ 0 }
+    , mPc{ 0 }
+    , mHalted{ false }
+{
+    std::ifstream file{ fileName };
+    if (!file)
+        throw std::runtime_error{ "Could not open " + fileName };
+
+    std::vector<std::string> lines{};
+    std::unordered_map<std::string, std::uint16_t> symbols{ PREDEFINED };
+
+    // First pass binds labels to the address of the next instruction
+    for (std::string line; std::getline(file, line);)
+    {
+        std::string code{ clean(line) };
+        if (code.empty())
+            continue;
+        if (code.front() == '(' && code.back() == ')')
+            symbols[code.substr(1, code.size() - 2)] = static_cast<std::uint16_t>(lines.size());
+        else
+            lines.push_back(std::move(code));
+    }
+
+    std::uint16_t nextVariable{ 16 };
+    for (const std::string& code : lines)
+    {
+        Instruction instr{};
+        if (code.front() == '@')
+        {
+            const std::string symbol{ code.substr(1) };
+            instr.isA = true;
+            if (isNumber(symbol))
+                instr.value = static_cast<std::uint16_t>(std::stoul(symbol));
+            else
+            {
+                auto found{ symbols.emplace(symbol, nextVariable) };
+                if (found.second)
+                    mVariables.emplace(symbol, nextVariable++);
+                instr.value = found.first->second;
+            }
+        }
+        else
+        {
+            std::string_view rest{ code };
+            const std::size_t eq{ rest.find('=') };
+            if (eq != std::string_view::npos)
+            {
+                for (char c : rest.substr(0, eq))
+                    instr.dest |= (c == 'M') ? DEST_M : (c == 'D') ? DEST_D : (c == 'A') ? DEST_A : 0;
+                rest.remove_prefix(eq + 1);
+            }
+
+            const std::size_t semi{ rest.find(';') };
+            if (semi != std::string_view::npos)
+            {
+                auto jump{ JUMPS.find(rest.substr(semi + 1)) };
+                if (jump == JUMPS.end())
+                    throw std::runtime_error{ "Bad jump in " + code };
+                instr.jump = jump->second;
+                rest = rest.substr(0, semi);
+            }
+
+            // M forms are looked up as the A form with the a bit set
+            std::string comp{ rest };
+            const bool useM{ comp.find('M') != std::string::npos };
+            for (char& c : comp)
+            {
+                if (c == 'M')
+                    c = 'A';
+            }
+            auto found{ COMPUTATIONS.find(comp) };
+            if (found == COMPUTATIONS.end())
+                throw std::runtime_error{ "Bad computation in " + code };
+            instr.comp = static_cast<std::uint8_t>(found->second | (useM ? COMP_A_BIT : 0));
+        }
+        mRom.push_back(instr);
+    }
+}
+
+std::int16_t HackEmulator::alu(std::uint8_t control, std::uint16_t x, std::uint16_t y)
+{
+    if (control & 0x20) x = 0;
+    if (control & 0x10) x = static_cast<std::uint16_t>(~x);
+    if (control & 0x08) y = 0;
+    if (control & 0x04) y = static_cast<std::uint16_t>(~y);
+    std::uint16_t out{ static_cast<std::uint16_t>((control & 0x02) ? x + y : x & y) };
+    if (control & 0x01) out = static_cast<std::uint16_t>(~out);
+    return static_cast<std::int16_t>(out);
+}
+
+std::uint64_t HackEmulator::run(std::uint64_t maxCycles)
+{
+    std::uint64_t cycles{ 0 };
+
+    while (cycles < maxCycles && mPc < mRom.size())
+    {
+        const Instruction& instr{ mRom[mPc] };
+        ++cycles;
+
+        if (instr.isA)
+        {
+            mA = instr.value;
+            ++mPc;
+            continue;
+        }
+
+        // Writes and the jump use A as it was before this instruction
+        const std::uint16_t target{ mA };
+        const std::uint16_t address{ static_cast<std::uint16_t>(mA & (RAM_SIZE - 1)) };
+        const std::uint16_t y{ (instr.comp & COMP_A_BIT) ? static_cast<std::uint16_t>(mRam[address]) : mA };
+        const std::int16_t out{ alu(instr.comp, mD, y) };
+
+        if (instr.dest & DEST_M)
+            mRam[address] = out;
+        if (instr.dest & DEST_D)
+            mD = static_cast<std::uint16_t>(out);
+        if (instr.dest & DEST_A)
+            mA = static_cast<std::uint16_t>(out);
+
+        const bool jump{ ((instr.jump & 4) && out < 0) || ((instr.jump & 2) && out == 0) || ((instr.jump & 1) && out > 0) };
+        if (!jump)
+        {
+            ++mPc;
+            continue;
+        }
+
+        // (END) @END 0;JMP
+        if (instr.jump == 7 && target + 1u == mPc && mRom[target].isA && mRom[target].value == target)
+        {
+            mHalted = true;
+            break;
+        }
+        mPc = target;
+    }
+    return cycles;
+}
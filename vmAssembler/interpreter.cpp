@@ -0,0 +1,482 @@
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "Interpreter.h"
+#include "Utils.h"
+#include "VMTranslator.h"
+
+namespace fs = std::filesystem;
+
+// Computed goto dispatch where the compiler supports it, a switch otherwise
+#if defined(__GNUC__)
+#define INTERPRETER_THREADED
+#endif
+
+constexpr std::int32_t ADDR_MASK = Interpreter::RAM_SIZE - 1;
+
+constexpr std::int32_t RAM_SP = 0;
+constexpr std::int32_t RAM_LCL = 1;
+constexpr std::int32_t RAM_ARG = 2;
+constexpr std::int32_t RAM_THIS = 3;
+constexpr std::int32_t RAM_THAT = 4;
+constexpr std::int32_t RAM_TEMP = 5;
+constexpr std::int32_t RAM_STATIC = 16;
+
+
+Interpreter::Interpreter(SymbolTable& symbols)
+    : mSymbols{ symbols }
+    , mOps{}
+    , mLabels{}
+    , mFunctionOps{}
+    , mStatics{}
+    , mJumpFixups{}
+    , mCallFixups{}
+    , mStats{}
+    , mCallCounts{}
+    , mFrames{}
+    , mRam(RAM_SIZE)
+    , mPc{ 0 }
+    , mFunction{ -1 }
+    , mHalted{ false }
+{
+}
+
+void Interpreter::load(const std::string& fileName, unsigned parseThreads)
+{
+    Parser parser{ fileName, mSymbols, parseThreads };
+    const SymbolTable::Id file{ mSymbols.intern(fs::path(fileName).filename().replace_extension().string()) };
+    SymbolTable::Id function{ mSymbols.intern("") };
+
+    for (const auto& instr : parser.instructions())
+    {
+        const std::string_view arg1{ mSymbols[instr.arg1] };
+
+        switch (instr.type)
+        {
+        case Parser::Command::C_PUSH:
+        case Parser::Command::C_POP:
+        {
+            const bool push{ instr.type == Parser::Command::C_PUSH };
+            Op op{ push ? OpCode::PUSH_DIRECT : OpCode::POP_DIRECT, 0, 0 };
+
+            // The parser rejects these with a line number already, ops
+            // built from anything else must not reach past temp or pointer
+            if (!utils::isValidIndex(arg1, instr.arg2))
+                throw std::runtime_error{ fileName + ": index out of range in '" + std::string{ mSymbols[instr.op] } + " "
+                    + std::string{ arg1 } + " " + std::to_string(instr.arg2) + "'" };
+
+            if (arg1 == "constant")
+                op = { OpCode::PUSH_CONSTANT, instr.arg2, 0 };
+            else if (arg1 == "local")
+                op = { push ? OpCode::PUSH_SEGMENT : OpCode::POP_SEGMENT, RAM_LCL, instr.arg2 };
+            else if (arg1 == "argument")
+                op = { push ? OpCode::PUSH_SEGMENT : OpCode::POP_SEGMENT, RAM_ARG, instr.arg2 };
+            else if (arg1 == "this")
+                op = { push ? OpCode::PUSH_SEGMENT : OpCode::POP_SEGMENT, RAM_THIS, instr.arg2 };
+            else if (arg1 == "that")
+                op = { push ? OpCode::PUSH_SEGMENT : OpCode::POP_SEGMENT, RAM_THAT, instr.arg2 };
+            else if (arg1 == "temp")
+                op.a = RAM_TEMP + instr.arg2;
+            else if (arg1 == "pointer")
+                op.a = RAM_THIS + instr.arg2;
+            else if (arg1 == "static")
+            {
+                // Allocated in order of first use like the assembler does
+                auto slot{ mStatics.emplace(mSymbols.qualify(file, '.', instr.arg2),
+                    RAM_STATIC + static_cast<std::int32_t>(mStatics.size())) };
+                op.a = slot.first->second;
+            }
+            else
+                throw std::runtime_error{ "Unknown segment " + std::string{ arg1 } };
+
+            mOps.push_back(op);
+            break;
+        }
+        case Parser::Command::C_ARITHMETIC_BI:
+        case Parser::Command::C_ARITHMETIC_UN:
+        case Parser::Command::C_COMPARISON:
+        {
+            static const std::pair<const char*, OpCode> ARITH[]{
+                { "add", OpCode::ADD }, { "sub", OpCode::SUB }, { "neg", OpCode::NEG },
+                { "and", OpCode::AND }, { "or", OpCode::OR }, { "not", OpCode::NOT },
+                { "eq", OpCode::EQ }, { "gt", OpCode::GT }, { "lt", OpCode::LT },
+            };
+            auto found{ std::find_if(std::begin(ARITH), std::end(ARITH), [&](const auto& a) { return arg1 == a.first; }) };
+            mOps.push_back({ found->second, 0, 0 });
+            break;
+        }
+        case Parser::Command::C_LABEL:
+            mLabels[mSymbols.qualify(function, '$', instr.arg1)] = mOps.size();
+            break;
+        case Parser::Command::C_GOTO:
+        case Parser::Command::C_IF:
+            mJumpFixups.push_back({ mOps.size(), mSymbols.qualify(function, '$', instr.arg1) });
+            mOps.push_back({ instr.type == Parser::Command::C_GOTO ? OpCode::GOTO : OpCode::IF_GOTO, 0, 0 });
+            break;
+        case Parser::Command::C_FUNCTION:
+            function = instr.arg1;
+            mFunctionOps[function] = mOps.size();
+            mOps.push_back({ OpCode::FUNCTION, instr.arg2, static_cast<std::int32_t>(mStats.size()) });
+            mStats.push_back({ function, 0, 0 });
+            break;
+        case Parser::Command::C_CALL:
+            mCallFixups.push_back({ mOps.size(), instr.arg1 });
+            mOps.push_back({ OpCode::CALL, 0, instr.arg2 });
+            break;
+        case Parser::Command::C_RETURN:
+            mOps.push_back({ OpCode::RETURN, 0, 0 });
+            break;
+        case Parser::Command::C_NOT_IMPLEMENTED:
+        default:
+            break;
+        }
+    }
+}
+
+void Interpreter::link()
+{
+    const std::size_t haltOp{ mOps.size() };
+    mOps.push_back({ OpCode::HALT, 0, 0 });
+
+    for (const auto& fix : mJumpFixups)
+    {
+        auto found{ mLabels.find(fix.target) };
+        if (found == mLabels.end())
+            throw std::runtime_error{ "Unknown label " + std::string{ mSymbols[fix.target] } };
+        mOps[fix.op].a = static_cast<std::int32_t>(found->second);
+
+        // label END; goto END is how programs stop
+        if (mOps[fix.op].code == OpCode::GOTO && found->second == fix.op)
+            mOps[fix.op].code = OpCode::HALT;
+    }
+
+    for (const auto& fix : mCallFixups)
+    {
+        auto found{ mFunctionOps.find(fix.target) };
+        if (found == mFunctionOps.end())
+            throw std::runtime_error{ "Unknown function " + std::string{ mSymbols[fix.target] } };
+        mOps[fix.op].a = static_cast<std::int32_t>(found->second);
+    }
+
+    auto sysInit{ mFunctionOps.find(mSymbols.intern("Sys.init")) };
+    if (sysInit == mFunctionOps.end())
+        throw std::runtime_error{ "Sys.init is not defined" };
+
+    // Same bootstrap as CodeWriter::init, SP = 256 then call Sys.init 0
+    std::fill(mRam.begin(), mRam.end(), std::int16_t{ 0 });
+    mRam[RAM_SP] = 256 + 5;
+    mRam[RAM_ARG] = 256;
+    mRam[RAM_LCL] = 256 + 5;
+    mCallCounts.assign(mOps.size(), 0);
+    mFrames.assign(1, { haltOp, -1 });
+    mPc = sysInit->second;
+    mFunction = mOps[mPc].b;
+}
+
+std::uint64_t Interpreter::run(std::uint64_t maxSteps)
+{
+    std::int16_t* const ram{ mRam.data() };
+    const Op* const ops{ mOps.data() };
+    std::uint64_t* const callCounts{ mCallCounts.data() };
+    const Op* op{ nullptr };
+    std::size_t pc{ mPc };
+    std::int32_t function{ mFunction };
+    std::uint64_t steps{ 0 };
+    std::uint64_t mark{ 0 };
+
+    auto push{ [ram](std::int32_t value) {
+        ram[ram[RAM_SP] & ADDR_MASK] = static_cast<std::int16_t>(value);
+        ++ram[RAM_SP];
+    } };
+    auto pop{ [ram]() {
+        --ram[RAM_SP];
+        return ram[ram[RAM_SP] & ADDR_MASK];
+    } };
+    auto top{ [ram]() -> std::int16_t& { return ram[(ram[RAM_SP] - 1) & ADDR_MASK]; } };
+    auto segment{ [ram](std::int32_t base, std::int32_t index) -> std::int16_t& {
+        return ram[(ram[base] + index) & ADDR_MASK];
+    } };
+
+    // Comparisons mirror the generated code: the sign of the 16 bit x - y
+    auto compare{ [&]() {
+        std::int16_t y{ pop() };
+        return static_cast<std::int16_t>(top() - y);
+    } };
+
+    // Attributes the instructions since the last switch to the function
+    auto account{ [&]() {
+        if (function >= 0)
+            mStats[function].instructions += steps - mark;
+        mark = steps;
+    } };
+
+#if defined(INTERPRETER_THREADED)
+    static void* const DISPATCH[]{
+        &&L_PUSH_CONSTANT, &&L_PUSH_SEGMENT, &&L_PUSH_DIRECT, &&L_POP_SEGMENT, &&L_POP_DIRECT,
+        &&L_ADD, &&L_SUB, &&L_NEG, &&L_AND, &&L_OR, &&L_NOT, &&L_EQ, &&L_GT, &&L_LT,
+        &&L_GOTO, &&L_IF_GOTO, &&L_FUNCTION, &&L_CALL, &&L_RETURN, &&L_HALT,
+    };
+#define VM_CASE(name) L_##name:
+#define VM_NEXT() \
+    do { \
+        if (steps == maxSteps) goto stopped; \
+        ++steps; \
+        op = &ops[pc]; \
+        goto *DISPATCH[static_cast<int>(op->code)]; \
+    } while (0)
+
+    VM_NEXT();
+#else
+#define VM_CASE(name) case OpCode::name:
+#define VM_NEXT() continue
+
+    for (;;)
+    {
+        if (steps == maxSteps)
+            goto stopped;
+        ++steps;
+        op = &ops[pc];
+
+        switch (op->code)
+        {
+#endif
+    VM_CASE(PUSH_CONSTANT)
+        push(op->a);
+        ++pc;
+        VM_NEXT();
+    VM_CASE(PUSH_SEGMENT)
+        push(segment(op->a, op->b));
+        ++pc;
+        VM_NEXT();
+    VM_CASE(PUSH_DIRECT)
+        push(ram[op->a & ADDR_MASK]);
+        ++pc;
+        VM_NEXT();
+    VM_CASE(POP_SEGMENT)
+        {
+            std::int16_t value{ pop() };
+            segment(op->a, op->b) = value;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(POP_DIRECT)
+        ram[op->a & ADDR_MASK] = pop();
+        ++pc;
+        VM_NEXT();
+    VM_CASE(ADD)
+        {
+            std::int16_t y{ pop() };
+            top() = static_cast<std::int16_t>(top() + y);
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(SUB)
+        {
+            std::int16_t y{ pop() };
+            top() = static_cast<std::int16_t>(top() - y);
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(NEG)
+        top() = static_cast<std::int16_t>(-top());
+        ++pc;
+        VM_NEXT();
+    VM_CASE(AND)
+        {
+            std::int16_t y{ pop() };
+            top() &= y;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(OR)
+        {
+            std::int16_t y{ pop() };
+            top() |= y;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(NOT)
+        top() = static_cast<std::int16_t>(~top());
+        ++pc;
+        VM_NEXT();
+    VM_CASE(EQ)
+        {
+            std::int16_t d{ compare() };
+            top() = (d == 0) ? -1 : 0;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(GT)
+        {
+            std::int16_t d{ compare() };
+            top() = (d > 0) ? -1 : 0;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(LT)
+        {
+            std::int16_t d{ compare() };
+            top() = (d < 0) ? -1 : 0;
+        }
+        ++pc;
+        VM_NEXT();
+    VM_CASE(GOTO)
+        pc = op->a;
+        VM_NEXT();
+    VM_CASE(IF_GOTO)
+        pc = (pop() != 0) ? op->a : pc + 1;
+        VM_NEXT();
+    VM_CASE(FUNCTION)
+        for (std::int32_t i = 0; i < op->a; ++i)
+            push(0);
+        ++mStats[op->b].calls;
+        ++pc;
+        VM_NEXT();
+    VM_CASE(CALL)
+        // The word in the return address slot is only kept so the frame
+        // has the CodeWriter layout, control returns through mFrames.
+        push(static_cast<std::int32_t>(pc + 1));
+        push(ram[RAM_LCL]);
+        push(ram[RAM_ARG]);
+        push(ram[RAM_THIS]);
+        push(ram[RAM_THAT]);
+        ram[RAM_ARG] = static_cast<std::int16_t>(ram[RAM_SP] - 5 - op->b);
+        ram[RAM_LCL] = ram[RAM_SP];
+        mFrames.push_back({ pc + 1, function });
+        ++callCounts[pc];
+        account();
+        pc = op->a;
+        function = ops[pc].b;
+        VM_NEXT();
+    VM_CASE(RETURN)
+        {
+            const std::int32_t frame{ ram[RAM_LCL] };
+            ram[ram[RAM_ARG] & ADDR_MASK] = pop();
+            ram[RAM_SP] = static_cast<std::int16_t>(ram[RAM_ARG] + 1);
+            ram[RAM_THAT] = ram[(frame - 1) & ADDR_MASK];
+            ram[RAM_THIS] = ram[(frame - 2) & ADDR_MASK];
+            ram[RAM_ARG] = ram[(frame - 3) & ADDR_MASK];
+            ram[RAM_LCL] = ram[(frame - 4) & ADDR_MASK];
+        }
+        account();
+        pc = mFrames.back().returnOp;
+        function = mFrames.back().function;
+        mFrames.pop_back();
+        VM_NEXT();
+    VM_CASE(HALT)
+        --steps;
+        mHalted = true;
+        goto stopped;
+#if !defined(INTERPRETER_THREADED)
+        }
+    }
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+
+stopped:
+    account();
+    mPc = pc;
+    mFunction = function;
+    return steps;
+}
+
+std::vector<Interpreter::FunctionStats> Interpreter::functionStats() const
+{
+    std::vector<FunctionStats> stats{ mStats };
+    std::stable_sort(stats.begin(), stats.end(), [](const FunctionStats& a, const FunctionStats& b) {
+        return a.instructions > b.instructions;
+        });
+    return stats;
+}
+
+void Interpreter::writeReport(std::ostream& out, std::size_t top) const
+{
+    std::vector<FunctionStats> stats{ functionStats() };
+    std::uint64_t total{ 0 };
+    for (const auto& s : stats)
+        total += s.instructions;
+
+    out << "Executed " << total << " VM instructions"
+        << (mHalted ? "" : " (stopped at the step limit)") << '\n';
+    out << "Instructions per function:\n";
+
+    stats.resize(std::min(top, stats.size()));
+    for (const auto& s : stats)
+    {
+        if (!s.calls)
+            continue;
+        out << "  " << std::left << std::setw(32) << mSymbols[s.name] << std::right
+            << std::setw(12) << s.instructions
+            << std::setw(8) << std::fixed << std::setprecision(1)
+            << (total ? 100.0 * static_cast<double>(s.instructions) / static_cast<double>(total) : 0.0) << '%'
+            << "  calls " << s.calls << '\n';
+    }
+}
+
+void Interpreter::writeProfile(std::ostream& out) const
+{
+    out << "# function <name> <calls> <instructions>, call <caller> <callee> <count>\n";
+    for (const auto& s : mStats)
+        out << "function " << mSymbols[s.name] << ' ' << s.calls << ' ' << s.instructions << '\n';
+
+    // Call ops are summed per caller/callee pair, the caller being the
+    // last function op before them
+    std::map<std::pair<std::string_view, std::string_view>, std::uint64_t> calls{};
+    std::string_view caller{};
+    for (std::size_t i = 0; i < mOps.size(); ++i)
+    {
+        if (mOps[i].code == OpCode::FUNCTION)
+            caller = mSymbols[mStats[mOps[i].b].name];
+        else if (mOps[i].code == OpCode::CALL && !caller.empty() && i < mCallCounts.size() && mCallCounts[i])
+            calls[{ caller, mSymbols[mStats[mOps[mOps[i].a].b].name] }] += mCallCounts[i];
+    }
+    for (const auto& call : calls)
+        out << "call " << call.first.first << ' ' << call.first.second << ' ' << call.second << '\n';
+}
+
+void interpret_VM_files(const std::string& f, unsigned parseThreads, std::uint64_t maxSteps,
+    int dumpBegin, int dumpEnd, const std::string& profileName)
+{
+    std::string asmName{};
+    const std::vector<std::string> files{ collectVMFiles(f, asmName) };
+    if (files.empty())
+        return;
+
+    try
+    {
+        SymbolTable symbols{};
+        Interpreter vm{ symbols };
+
+        for (const auto& g : files)
+            vm.load(g, parseThreads);
+        vm.link();
+        vm.run(maxSteps);
+
+        vm.writeReport(std::cout);
+        std::cout << "SP = " << vm.ram()[RAM_SP] << '\n';
+        for (int addr = std::max(dumpBegin, 0); addr < std::min<int>(dumpEnd, Interpreter::RAM_SIZE); ++addr)
+            std::cout << "RAM[" << addr << "] = " << vm.ram()[addr] << '\n';
+
+        if (!profileName.empty())
+        {
+            std::ofstream out{ profileName };
+            if (!out)
+                throw std::runtime_error{ "Could not open " + profileName };
+            vm.writeProfile(out);
+            std::cout << "Wrote profile " << profileName << '\n';
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << '\n';
+    }
+}
@@ -0,0 +1,119 @@
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "JumpThreading.h"
+
+namespace
+{
+    using Command = Parser::Command;
+
+    bool isJump(const Parser::Instruction& instr)
+    {
+        return instr.type == Command::C_GOTO || instr.type == Command::C_IF;
+    }
+
+    /*
+    * First command at or after at that is not a label.
+    */
+    std::size_t skipLabels(const std::pmr::vector<Parser::Instruction>& code, std::size_t at)
+    {
+        while (at < code.size() && code[at].type == Command::C_LABEL)
+            ++at;
+        return at;
+    }
+}
+
+JumpThreadingStats threadJumps(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols,
+    std::pmr::memory_resource* memory)
+{
+    JumpThreadingStats stats{};
+
+    // Scope of every command and where each function$label is
+    std::pmr::vector<SymbolTable::Id> scope{ memory };
+    std::pmr::unordered_map<SymbolTable::Id, std::size_t> labels{ memory };
+    scope.reserve(code.size());
+
+    SymbolTable::Id function{ symbols.intern("") };
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].type == Command::C_FUNCTION)
+            function = code[i].arg1;
+        else if (code[i].type == Command::C_LABEL)
+            labels[symbols.qualify(function, '$', code[i].arg1)] = i;
+        scope.push_back(function);
+    }
+
+    // Follows label -> goto -> label... A chain longer than the number
+    // of labels is a loop of gotos and keeps its original target.
+    auto resolve{ [&](SymbolTable::Id fn, SymbolTable::Id label) {
+        SymbolTable::Id target{ label };
+        for (std::size_t hops = 0; hops <= labels.size(); ++hops)
+        {
+            auto found{ labels.find(symbols.qualify(fn, '$', target)) };
+            if (found == labels.end())
+                return target;
+
+            const std::size_t next{ skipLabels(code, found->second + 1) };
+            if (next >= code.size() || code[next].type != Command::C_GOTO || code[next].arg1 == target)
+                return target;
+            target = code[next].arg1;
+        }
+        return label;
+    } };
+
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (!isJump(code[i]))
+            continue;
+        const SymbolTable::Id target{ resolve(scope[i], code[i].arg1) };
+        if (target != code[i].arg1)
+        {
+            code[i].arg1 = target;
+            ++stats.retargeted;
+        }
+    }
+
+    std::pmr::vector<bool> dead(code.size(), false, memory);
+
+    // goto L where only labels separate it from label L
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].type != Command::C_GOTO)
+            continue;
+        for (std::size_t j = i + 1; j < code.size() && code[j].type == Command::C_LABEL; ++j)
+        {
+            if (code[j].arg1 == code[i].arg1)
+            {
+                dead[i] = true;
+                ++stats.gotosRemoved;
+                break;
+            }
+        }
+    }
+
+    std::pmr::unordered_map<SymbolTable::Id, std::size_t> references{ memory };
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (!dead[i] && isJump(code[i]))
+            ++references[symbols.qualify(scope[i], '$', code[i].arg1)];
+    }
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].type == Command::C_LABEL && !references.count(symbols.qualify(scope[i], '$', code[i].arg1)))
+        {
+            dead[i] = true;
+            ++stats.labelsRemoved;
+        }
+    }
+
+    std::size_t kept{ 0 };
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (!dead[i])
+            code[kept++] = code[i];
+    }
+    code.resize(kept);
+
+    return stats;
+}
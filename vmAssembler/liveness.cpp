@@ -0,0 +1,116 @@
+
+#include <algorithm>
+
+#include "Liveness.h"
+
+// Commands looked at per query before giving up and assuming a read.
+constexpr std::size_t MAX_STEPS = 512;
+
+
+Liveness::Liveness(const std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols,
+    std::pmr::memory_resource* memory)
+    : mCode{ code }
+    , mSymbols{ symbols }
+    , mMemory{ memory }
+    , mLabels{ memory }
+    , mPointer{ symbols.intern("pointer") }
+    , mThat{ symbols.intern("that") }
+    , mTemp{ symbols.intern("temp") }
+{
+    SymbolTable::Id function{ symbols.intern("") };
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        if (code[i].type == Parser::Command::C_FUNCTION)
+            function = code[i].arg1;
+        else if (code[i].type == Parser::Command::C_LABEL)
+            mLabels[symbols.qualify(function, '$', code[i].arg1)] = i;
+    }
+}
+
+Liveness::Effect Liveness::effectOf(Location loc, const Parser::Instruction& instr) const
+{
+    switch (instr.type)
+    {
+    case Parser::Command::C_PUSH:
+    case Parser::Command::C_POP:
+    {
+        const bool push{ instr.type == Parser::Command::C_PUSH };
+        if (loc == Location::THAT)
+        {
+            // that n goes through THAT, pointer 1 is THAT itself
+            if (instr.arg1 == mThat)
+                return Effect::READ;
+            if (instr.arg1 == mPointer && instr.arg2 == 1)
+                return push ? Effect::READ : Effect::WRITE;
+        }
+        else if (instr.arg1 == mTemp && instr.arg2 == 0)
+            return push ? Effect::READ : Effect::WRITE;
+        return Effect::NONE;
+    }
+    case Parser::Command::C_ASSIGN:
+        // Writes a constant to arg1 arg2, through THAT for that n
+        if (loc == Location::THAT && instr.arg1 == mThat)
+            return Effect::READ;
+        if ((loc == Location::THAT) ? (instr.arg1 == mPointer && instr.arg2 == 1)
+            : (instr.arg1 == mTemp && instr.arg2 == 0))
+            return Effect::WRITE;
+        return Effect::NONE;
+    case Parser::Command::C_ARRAY_READ:
+        // Stood for a pop pointer 1 whatever it writes now
+        return (loc == Location::THAT) ? Effect::WRITE : Effect::NONE;
+    case Parser::Command::C_ARRAY_WRITE:
+        return Effect::WRITE;
+    case Parser::Command::C_RETURN:
+        // The caller's THAT is restored from the frame, temp is global
+        return (loc == Location::THAT) ? Effect::WRITE : Effect::READ;
+    case Parser::Command::C_CALL:
+    case Parser::Command::C_FUNCTION:
+        return Effect::READ;
+    default:
+        return Effect::NONE;
+    }
+}
+
+bool Liveness::isLive(Location loc, std::size_t from, SymbolTable::Id function) const
+{
+    std::pmr::vector<std::size_t> work{ { from }, mMemory };
+    std::pmr::vector<std::size_t> seen{ mMemory };
+    std::size_t steps{ 0 };
+
+    while (!work.empty())
+    {
+        std::size_t at{ work.back() };
+        work.pop_back();
+
+        for (;;)
+        {
+            if (at >= mCode.size() || ++steps > MAX_STEPS)
+                return true;
+
+            const Parser::Instruction& instr{ mCode[at] };
+            const Effect effect{ effectOf(loc, instr) };
+            if (effect == Effect::READ)
+                return true;
+            if (effect == Effect::WRITE)
+                break;
+
+            if (instr.type == Parser::Command::C_GOTO || instr.type == Parser::Command::C_IF)
+            {
+                auto found{ mLabels.find(mSymbols.qualify(function, '$', instr.arg1)) };
+                if (found == mLabels.end())
+                    return true;
+
+                // Loops come back to labels already walked from
+                if (std::find(seen.begin(), seen.end(), found->second) == seen.end())
+                {
+                    seen.push_back(found->second);
+                    work.push_back(found->second);
+                }
+                if (instr.type == Parser::Command::C_GOTO)
+                    break;
+            }
+            ++at;
+        }
+    }
+    return false;
+}
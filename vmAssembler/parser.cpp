@@ -1,103 +1,246 @@
-#include <iostream>
+
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <stdexcept>
 #include <string>
-#include <sstream>
+#include <thread>
 
 #include "Utils.h"
 #include "Parser.h"
+#include "Scanner.h"
+
+// Files smaller than this are not worth the thread start up cost.
+constexpr std::size_t MIN_CHUNK_SIZE = 256 * 1024;
+
+// Chunks handed out per thread so a slow chunk does not stall the others.
+constexpr unsigned CHUNKS_PER_THREAD = 4;
 
 
-Parser::Parser(const std::string& fileName)
-    : mFile{ fileName }
-    , mCommand{}
-    , mNxtCommand{}
+Parser::Parser(const std::string& fileName, SymbolTable& symbols, unsigned threads,
+    std::pmr::memory_resource* memory)
+    : mSymbols{ symbols }
+    , mMemory{ memory }
+    , mInstructions{ memory }
+    , mCurrent{ 0 }
+    , mNext{ 0 }
 {
-    __advance(mNxtCommand);
+    std::ifstream file{ fileName, std::ios::binary | std::ios::ate };
+    if (!file)
+        throw std::runtime_error{ "Could not open " + fileName };
+
+    // Sized up front so the text is a single allocation
+    std::pmr::string text{ memory };
+    text.resize(static_cast<std::size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(text.data(), static_cast<std::streamsize>(text.size()));
+    text.resize(static_cast<std::size_t>(file.gcount()));
+
+    // Roughly one command per 12 bytes of typical compiler output
+    mInstructions.reserve(text.size() / 12);
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    const char* bad{ (threads > 1 && text.size() >= 2 * MIN_CHUNK_SIZE)
+        ? parseParallel(text, threads)
+        : tokenize(text.data(), text.data() + text.size(), mInstructions, mSymbols) };
+
+    // Lines are only counted on the way out
+    if (bad)
+    {
+        const char* const textEnd{ text.data() + text.size() };
+        const std::size_t line{ 1 + static_cast<std::size_t>(std::count(static_cast<const char*>(text.data()), bad, '\n')) };
+        const std::string_view command{ utils::removeComments({ bad,
+            static_cast<std::size_t>(scanner::findChar(bad, textEnd, '\n') - bad) }) };
+        throw std::runtime_error{ fileName + ":" + std::to_string(line) + ": index out of range in '"
+            + std::string{ command } + "'" };
+    }
 }
 
-void Parser::__advance(std::stringstream& strm)
+const char* Parser::tokenize(const char* begin, const char* end, std::pmr::vector<Instruction>& out,
+    SymbolTable& symbols)
 {
-    strm.clear();
-    strm.str("");
+    while (begin < end)
+    {
+        const char* const lineStart{ begin };
+        const char* lineEnd{ scanner::findChar(begin, end, '\n') };
+        std::string_view line{ utils::removeComments({ begin, static_cast<std::size_t>(lineEnd - begin) }) };
+        begin = (lineEnd != end) ? lineEnd + 1 : end;
+
+        if (line.empty())
+            continue;
+
+        // Split into at most three whitespace separated words
+        std::string_view words[3]{};
+        std::size_t count{ 0 };
+        const char* const last{ line.data() + line.size() };
+        for (const char* p{ line.data() }; p != last && count < 3;)
+        {
+            const char* wordEnd{ scanner::findSpace(p, last) };
+            words[count++] = { p, static_cast<std::size_t>(wordEnd - p) };
+            p = scanner::skipSpace(wordEnd, last);
+        }
 
-    while (hasMoreLines())
+        Instruction instr{};
+        auto type{ utils::commandMap.find(words[0]) };
+        instr.type = (type != utils::commandMap.end()) ? type->second : Command::C_NOT_IMPLEMENTED;
+        instr.op = symbols.intern(words[0]);
+
+        if (instr.type == Command::C_ARITHMETIC_BI ||
+            instr.type == Command::C_ARITHMETIC_UN ||
+            instr.type == Command::C_COMPARISON)
+            instr.arg1 = instr.op;
+        else
+            instr.arg1 = symbols.intern(words[1]);
+
+        instr.arg2 = utils::toInt(words[2]);
+        if ((instr.type == Command::C_PUSH || instr.type == Command::C_POP)
+            && !utils::isValidIndex(words[1], instr.arg2))
+            return lineStart;
+        out.push_back(instr);
+    }
+    return nullptr;
+}
+
+const char* Parser::parseParallel(const std::pmr::string& text, unsigned threads)
+{
+    struct Chunk
     {
-        std::string temp;
-        std::getline(mFile, temp);
+        const char* begin;
+        const char* end;
+        std::pmr::vector<Instruction> code;
+        const char* bad{ nullptr };
+
+        // Each chunk interns into its own table, merged into mSymbols after
+        SymbolTable symbols;
+        std::vector<SymbolTable::Id> remap;
+        std::size_t offset;
+    };
+
+    const std::size_t nChunks{ std::min<std::size_t>(threads * CHUNKS_PER_THREAD, text.size() / MIN_CHUNK_SIZE) };
+    std::vector<Chunk> chunks(nChunks);
+
+    // Split at newline boundaries so no line straddles two chunks
+    const char* const textEnd{ text.data() + text.size() };
+    const char* begin{ text.data() };
+    for (std::size_t i = 0; i < nChunks; ++i)
+    {
+        const char* end{ (i + 1 == nChunks) ? textEnd : text.data() + text.size() * (i + 1) / nChunks };
+        if (end < begin)
+            end = begin;
+        end = scanner::findChar(end, textEnd, '\n');
+        if (end != textEnd)
+            ++end;
+        chunks[i].begin = begin;
+        chunks[i].end = end;
+        begin = end;
+    }
 
-        utils::removeComments(temp);
+    auto runPool{ [&](auto job) {
+        std::atomic<std::size_t> next{ 0 };
+        auto worker{ [&]() {
+            for (std::size_t i = next++; i < chunks.size(); i = next++)
+                job(chunks[i]);
+        } };
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; ++t)
+            pool.emplace_back(worker);
+        worker();
+        for (auto& t : pool)
+            t.join();
+    } };
+
+    runPool([](Chunk& c) { c.bad = tokenize(c.begin, c.end, c.code, c.symbols); });
+
+    // Chunks are in text order so the first failure is the first bad line
+    for (const auto& c : chunks)
+    {
+        if (c.bad)
+            return c.bad;
+    }
 
-        if (!temp.empty())
-        {
-            strm << temp;
-            break;
-        }
+    // Merging the tables touches each distinct name once, the per
+    // command remapping below runs on the pool again.
+    std::size_t total{ 0 };
+    for (auto& c : chunks)
+    {
+        c.remap.resize(c.symbols.size());
+        for (SymbolTable::Id id = 0; id < c.symbols.size(); ++id)
+            c.remap[id] = mSymbols.intern(c.symbols[id]);
+        c.offset = total;
+        total += c.code.size();
     }
+
+    mInstructions.resize(total);
+    runPool([this](Chunk& c) {
+        auto out{ mInstructions.begin() + c.offset };
+        for (const auto& instr : c.code)
+            *out++ = { instr.type, c.remap[instr.op], c.remap[instr.arg1], instr.arg2 };
+    });
+    return nullptr;
 }
 
 void Parser::advance()
 {
-    mCommand.clear();
-    mCommand.str("");
-    mCommand << mNxtCommand.str();
-    if (hasMoreLines())
-        __advance(mNxtCommand);
+    mCurrent = mNext++;
 }
 
 Parser::Command Parser::commandType()
 {
-    std::string cmd;
-    mCommand >> cmd;
-    auto type{ utils::commandMap.find(cmd) };
-    resetStream(mCommand);
-
-    if (type != utils::commandMap.end())
-        return type->second;
-    else
-        return Command::C_NOT_IMPLEMENTED;
+    return mInstructions[mCurrent].type;
 }
 
 Parser::Command Parser::peekNxtCommandType()
 {
-    std::string cmd;
-    mNxtCommand >> cmd;
-    auto type{ utils::commandMap.find(cmd) };
-    resetStream(mNxtCommand);
-
-    if (type != utils::commandMap.end())
-        return type->second;
+    if (mNext < mInstructions.size())
+        return mInstructions[mNext].type;
     else
         return Command::C_NOT_IMPLEMENTED;
 }
 
-std::string Parser::arg1()
+std::string_view Parser::arg1()
 {
-    Command cmdType{ commandType() };
-    std::string cmd;
-    std::string arg1{};
-    mCommand >> cmd >> arg1;
-    if (cmdType == Command::C_ARITHMETIC_BI ||
-        cmdType == Command::C_ARITHMETIC_UN ||
-        cmdType == Command::C_COMPARISON)
-        return cmd;
-    else
-        return arg1;
+    return mSymbols[mInstructions[mCurrent].arg1];
 }
 
-int Parser::arg2()
+SymbolTable::Id Parser::arg1Symbol()
 {
-    int arg2;
-    mCommand >> arg2;
-    return arg2;
+    return mInstructions[mCurrent].arg1;
 }
 
-void Parser::resetStream(std::stringstream& strm)
+int Parser::arg2()
 {
-    strm.seekg(0, std::ios_base::beg);
+    return mInstructions[mCurrent].arg2;
 }
 
-std::string Parser::returnCommand()
+int Parser::arg3()
 {
-    return mCommand.str();
+    return mInstructions[mCurrent].arg3;
 }
 
+std::pmr::string Parser::returnCommand()
+{
+    const Instruction& instr{ mInstructions[mCurrent] };
+    std::pmr::string line{ mSymbols[instr.op], mMemory };
+
+    switch (instr.type)
+    {
+    case Command::C_PUSH:
+    case Command::C_POP:
+    case Command::C_FUNCTION:
+    case Command::C_CALL:
+        line.append(1, ' ').append(mSymbols[instr.arg1]).append(1, ' ');
+        utils::appendInt(line, instr.arg2);
+        break;
+    case Command::C_LABEL:
+    case Command::C_GOTO:
+    case Command::C_IF:
+        line.append(1, ' ').append(mSymbols[instr.arg1]);
+        break;
+    default:
+        break;
+    }
+    return line;
+}
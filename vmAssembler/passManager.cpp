@@ -0,0 +1,122 @@
+
+#include <iomanip>
+
+#include "JumpThreading.h"
+#include "PassManager.h"
+#include "Peephole.h"
+
+namespace
+{
+    struct PassInfo
+    {
+        const char* name;
+
+        /*
+        * Lowest -O level the pass is part of.
+        */
+        int level;
+    };
+
+    const PassInfo PASSES[PassManager::PASS_COUNT]{
+        { "jump-threading", 1 },
+        { "array-fusion", 2 },
+        { "math-inline", 2 },
+        { "const-assign", 1 },
+        { "lean-return", 1 },
+    };
+}
+
+PassManager::PassManager(int level)
+    : mEnabled{}
+    , mStats{}
+    , mOptimizeSize{ false }
+{
+    setLevel(level);
+}
+
+void PassManager::setLevel(int level)
+{
+    for (std::size_t i = 0; i < PASS_COUNT; ++i)
+        mEnabled[i] = PASSES[i].level <= level;
+}
+
+bool PassManager::setEnabled(std::string_view name, bool enabled)
+{
+    for (std::size_t i = 0; i < PASS_COUNT; ++i)
+    {
+        if (name == PASSES[i].name)
+        {
+            mEnabled[i] = enabled;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string_view PassManager::name(Pass pass)
+{
+    return PASSES[static_cast<std::size_t>(pass)].name;
+}
+
+void PassManager::run(std::pmr::vector<Parser::Instruction>& code, SymbolTable& symbols)
+{
+    for (std::size_t i = 0; i < PASS_COUNT; ++i)
+    {
+        if (!mEnabled[i])
+            continue;
+
+        Stats& stats{ mStats[i] };
+        const auto start{ std::chrono::steady_clock::now() };
+        stats.before += code.size();
+
+        switch (static_cast<Pass>(i))
+        {
+        case Pass::JUMP_THREADING:
+        {
+            const JumpThreadingStats jumps{ threadJumps(code, symbols, code.get_allocator().resource()) };
+            stats.rewrites += jumps.retargeted + jumps.gotosRemoved + jumps.labelsRemoved;
+            break;
+        }
+        case Pass::ARRAY_FUSION:
+            stats.rewrites += fuseArrayAccess(code, symbols);
+            break;
+        case Pass::MATH_INLINE:
+            stats.rewrites += inlineConstantMath(code, symbols, mOptimizeSize);
+            break;
+        case Pass::CONST_ASSIGN:
+            stats.rewrites += foldConstantAssignments(code, symbols);
+            break;
+        case Pass::LEAN_RETURN:
+            stats.rewrites += specializeReturns(code, symbols);
+            break;
+        }
+
+        stats.after += code.size();
+        stats.time += std::chrono::steady_clock::now() - start;
+    }
+}
+
+void PassManager::resetStats()
+{
+    mStats = {};
+}
+
+void PassManager::writeReport(std::ostream& out) const
+{
+    out << "Passes:\n";
+    for (std::size_t i = 0; i < PASS_COUNT; ++i)
+    {
+        out << "  " << std::left << std::setw(16) << PASSES[i].name << std::right;
+        if (!mEnabled[i])
+        {
+            out << "off\n";
+            continue;
+        }
+
+        const Stats& s{ mStats[i] };
+        const double ms{ std::chrono::duration<double, std::milli>(s.time).count() };
+        out << std::setw(8) << s.rewrites << " rewrites  "
+            << s.before << " -> " << s.after << " commands  "
+            << std::fixed << std::setprecision(3) << ms << " ms\n";
+    }
+}
@@ -0,0 +1,198 @@
+
+#include <algorithm>
+
+#include "CodeWriter.h"
+#include "Liveness.h"
+#include "Peephole.h"
+
+namespace
+{
+    using Command = Parser::Command;
+    using Code = std::pmr::vector<Parser::Instruction>;
+
+    bool matches(const Code& code, std::size_t at, Command type, SymbolTable::Id arg1, int arg2)
+    {
+        return at < code.size() && code[at].type == type && code[at].arg1 == arg1 && code[at].arg2 == arg2;
+    }
+
+    /*
+    * The enclosing function of every command, labels are scoped by it.
+    */
+    std::pmr::vector<SymbolTable::Id> functionsOf(const Code& code, SymbolTable& symbols)
+    {
+        std::pmr::vector<SymbolTable::Id> scope{ code.get_allocator().resource() };
+        scope.reserve(code.size());
+
+        SymbolTable::Id function{ symbols.intern("") };
+        for (const auto& instr : code)
+        {
+            if (instr.type == Command::C_FUNCTION)
+                function = instr.arg1;
+            scope.push_back(function);
+        }
+        return scope;
+    }
+}
+
+std::size_t fuseArrayAccess(Code& code, SymbolTable& symbols)
+{
+    const SymbolTable::Id pointer{ symbols.intern("pointer") };
+    const SymbolTable::Id that{ symbols.intern("that") };
+    const SymbolTable::Id temp{ symbols.intern("temp") };
+    const SymbolTable::Id add{ symbols.intern("add") };
+
+    // Liveness walks back to loop heads, so the input stays intact
+    // until every decision is made
+    const Liveness liveness{ code, symbols, code.get_allocator().resource() };
+    const std::pmr::vector<SymbolTable::Id> scope{ functionsOf(code, symbols) };
+    Code out{ code.get_allocator().resource() };
+    out.reserve(code.size());
+    std::size_t fused{ 0 };
+
+    for (std::size_t i = 0; i < code.size();)
+    {
+        const Parser::Instruction& instr{ code[i] };
+
+        if (instr.type == Command::C_ARITHMETIC_BI && instr.op == add
+            && matches(code, i + 1, Command::C_POP, pointer, 1)
+            && matches(code, i + 2, Command::C_PUSH, that, 0))
+        {
+            const bool setThat{ liveness.isLive(Liveness::Location::THAT, i + 3, scope[i]) };
+            out.push_back({ Command::C_ARRAY_READ, symbols.intern("array-read"), that, setThat, 0 });
+            i += 3;
+            ++fused;
+        }
+        else if (matches(code, i, Command::C_POP, temp, 0)
+            && matches(code, i + 1, Command::C_POP, pointer, 1)
+            && matches(code, i + 2, Command::C_PUSH, temp, 0)
+            && matches(code, i + 3, Command::C_POP, that, 0))
+        {
+            const bool setThat{ liveness.isLive(Liveness::Location::THAT, i + 4, scope[i]) };
+            const bool setTemp{ liveness.isLive(Liveness::Location::TEMP0, i + 4, scope[i]) };
+            out.push_back({ Command::C_ARRAY_WRITE, symbols.intern("array-write"), that, setThat, setTemp });
+            i += 4;
+            ++fused;
+        }
+        else
+            out.push_back(code[i++]);
+    }
+
+    code.swap(out);
+    return fused;
+}
+
+std::size_t inlineConstantMath(Code& code, SymbolTable& symbols, bool optimizeSize)
+{
+    const SymbolTable::Id constant{ symbols.intern("constant") };
+    const SymbolTable::Id multiply{ symbols.intern("Math.multiply") };
+    const SymbolTable::Id divide{ symbols.intern("Math.divide") };
+    const std::size_t maxDivide{ optimizeSize
+        ? std::min(CodeWriter::MAX_INLINE_DIVIDE, CodeWriter::CONSTANT_CALL_SIZE) : CodeWriter::MAX_INLINE_DIVIDE };
+    std::size_t kept{ 0 }, reduced{ 0 };
+
+    for (std::size_t i = 0; i < code.size();)
+    {
+        const Parser::Instruction& instr{ code[i] };
+        const bool constantCall{ instr.type == Command::C_PUSH && instr.arg1 == constant
+            && i + 1 < code.size() && code[i + 1].type == Command::C_CALL && code[i + 1].arg2 == 2 };
+
+        // push constant only takes 0..32767 so k is never negative.
+        // Only powers of two divide inline, other divisors stay calls.
+        if (constantCall && instr.arg2 == 1 && (code[i + 1].arg1 == multiply || code[i + 1].arg1 == divide))
+        {
+            i += 2;
+            ++reduced;
+        }
+        else if (constantCall && code[i + 1].arg1 == multiply && instr.arg2 >= 0
+            && CodeWriter::multiplySize(instr.arg2) <= CodeWriter::MAX_INLINE_MULTIPLY)
+        {
+            code[kept++] = { Command::C_MULTIPLY, symbols.intern("multiply"), multiply, instr.arg2, 0 };
+            i += 2;
+            ++reduced;
+        }
+        else if (constantCall && code[i + 1].arg1 == divide && instr.arg2 > 1 && !(instr.arg2 & (instr.arg2 - 1))
+            && CodeWriter::divideSize(instr.arg2) <= maxDivide)
+        {
+            code[kept++] = { Command::C_DIVIDE, symbols.intern("divide"), divide, instr.arg2, 0 };
+            i += 2;
+            ++reduced;
+        }
+        else
+            code[kept++] = code[i++];
+    }
+
+    code.resize(kept);
+    return reduced;
+}
+
+std::size_t foldConstantAssignments(Code& code, SymbolTable& symbols)
+{
+    const SymbolTable::Id constant{ symbols.intern("constant") };
+    std::size_t kept{ 0 }, folded{ 0 };
+
+    for (std::size_t i = 0; i < code.size();)
+    {
+        const Parser::Instruction& instr{ code[i] };
+
+        if (instr.type == Command::C_PUSH && instr.arg1 == constant
+            && i + 1 < code.size() && code[i + 1].type == Command::C_POP)
+        {
+            const Parser::Instruction& pop{ code[i + 1] };
+            code[kept++] = { Command::C_ASSIGN, symbols.intern("assignment"), pop.arg1, pop.arg2, instr.arg2 };
+            i += 2;
+            ++folded;
+        }
+        else
+            code[kept++] = code[i++];
+    }
+
+    code.resize(kept);
+    return folded;
+}
+
+std::size_t specializeReturns(Code& code, SymbolTable& symbols)
+{
+    const SymbolTable::Id constant{ symbols.intern("constant") };
+    const SymbolTable::Id pointer{ symbols.intern("pointer") };
+    std::size_t kept{ 0 }, specialized{ 0 };
+    int keeps{ 0 };
+
+    for (std::size_t i = 0; i < code.size();)
+    {
+        // What the function leaves alone is known before its first
+        // return is rewritten, commands from i on are not moved yet
+        if (i == 0 || code[i].type == Command::C_FUNCTION)
+        {
+            keeps = Parser::RETURN_KEEPS_THIS | Parser::RETURN_KEEPS_THAT;
+            for (std::size_t j = i; j < code.size() && (j == i || code[j].type != Command::C_FUNCTION); ++j)
+            {
+                const Parser::Instruction& instr{ code[j] };
+                if ((instr.type == Command::C_POP || instr.type == Command::C_ASSIGN) && instr.arg1 == pointer)
+                    keeps &= (instr.arg2 == 0) ? ~Parser::RETURN_KEEPS_THIS : ~Parser::RETURN_KEEPS_THAT;
+                else if ((instr.type == Command::C_ARRAY_READ || instr.type == Command::C_ARRAY_WRITE) && instr.arg2)
+                    keeps &= ~Parser::RETURN_KEEPS_THAT;
+            }
+        }
+
+        const Parser::Instruction& instr{ code[i] };
+        if (instr.type == Command::C_PUSH && instr.arg1 == constant
+            && i + 1 < code.size() && code[i + 1].type == Command::C_RETURN)
+        {
+            code[kept++] = { Command::C_RETURN, code[i + 1].op, constant, instr.arg2, keeps };
+            i += 2;
+            ++specialized;
+        }
+        else if (instr.type == Command::C_RETURN)
+        {
+            code[kept] = code[i++];
+            code[kept++].arg3 = keeps;
+            if (keeps)
+                ++specialized;
+        }
+        else
+            code[kept++] = code[i++];
+    }
+
+    code.resize(kept);
+    return specialized;
+}
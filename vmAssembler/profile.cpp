@@ -0,0 +1,86 @@
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "Profile.h"
+
+namespace
+{
+    std::uint64_t callKey(SymbolTable::Id caller, SymbolTable::Id callee)
+    {
+        return (std::uint64_t{ caller } << 32) | callee;
+    }
+}
+
+Profile::Profile(const std::string& fileName, SymbolTable& symbols)
+    : mInstructions{}
+    , mCalls{}
+    , mHot{}
+    , mHotSet{}
+{
+    std::ifstream in{ fileName };
+    if (!in)
+        throw std::runtime_error{ "Could not open profile " + fileName };
+
+    std::string line{};
+    for (int number = 1; std::getline(in, line); ++number)
+    {
+        std::istringstream words{ line };
+        std::string kind{}, first{}, second{};
+        std::uint64_t count{ 0 };
+
+        if (!(words >> kind) || kind.front() == '#')
+            continue;
+
+        bool valid{ false };
+        if (kind == "function")
+        {
+            std::uint64_t calls{ 0 };
+            valid = static_cast<bool>(words >> first >> calls >> count);
+            if (valid)
+                mInstructions[symbols.intern(first)] += count;
+        }
+        else if (kind == "call")
+        {
+            valid = static_cast<bool>(words >> first >> second >> count);
+            if (valid)
+                mCalls[callKey(symbols.intern(first), symbols.intern(second))] += count;
+        }
+
+        if (!valid)
+            throw std::runtime_error{ fileName + ":" + std::to_string(number) + ": malformed profile line" };
+    }
+
+    std::vector<std::pair<std::uint64_t, SymbolTable::Id>> order{};
+    std::uint64_t total{ 0 };
+    for (const auto& function : mInstructions)
+    {
+        order.emplace_back(function.second, function.first);
+        total += function.second;
+    }
+    std::sort(order.begin(), order.end(), [&](const auto& a, const auto& b) {
+        if (a.first != b.first)
+            return a.first > b.first;
+        return symbols[a.second] < symbols[b.second];
+        });
+
+    // The fewest functions covering HOT_COVERAGE of the instructions
+    std::uint64_t covered{ 0 };
+    for (const auto& function : order)
+    {
+        if (function.first == 0 || static_cast<double>(covered) >= HOT_COVERAGE * static_cast<double>(total))
+            break;
+        covered += function.first;
+        mHot.push_back(function.second);
+    }
+    mHotSet.insert(mHot.begin(), mHot.end());
+}
+
+std::uint64_t Profile::calls(SymbolTable::Id caller, SymbolTable::Id callee) const
+{
+    auto found{ mCalls.find(callKey(caller, callee)) };
+    return (found != mCalls.end()) ? found->second : 0;
+}
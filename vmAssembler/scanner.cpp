@@ -0,0 +1,156 @@
+
+#include <cstddef>
+
+#include "Scanner.h"
+
+#if defined(SCANNER_AVX2)
+#include <immintrin.h>
+#elif defined(SCANNER_SSE2)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace scanner
+{
+    namespace
+    {
+        inline unsigned lowestBit(unsigned mask)
+        {
+#if defined(_MSC_VER)
+            unsigned long idx;
+            _BitScanForward(&idx, mask);
+            return idx;
+#else
+            return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+        }
+
+#if defined(SCANNER_AVX2)
+        struct Vec
+        {
+            static constexpr std::size_t WIDTH = 32;
+            using Reg = __m256i;
+
+            static Reg load(const char* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static Reg eq(Reg v, char c) { return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)); }
+            static unsigned mask(Reg v) { return static_cast<unsigned>(_mm256_movemask_epi8(v)); }
+
+            // ' ' or '\t'..'\r', the range check is done as an unsigned min
+            static unsigned space(Reg v)
+            {
+                Reg ctl{ _mm256_sub_epi8(v, _mm256_set1_epi8('\t')) };
+                Reg inRange{ _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8('\r' - '\t')), ctl) };
+                return mask(_mm256_or_si256(eq(v, ' '), inRange));
+            }
+            static constexpr unsigned ALL = 0xFFFFFFFFu;
+        };
+#elif defined(SCANNER_SSE2)
+        struct Vec
+        {
+            static constexpr std::size_t WIDTH = 16;
+            using Reg = __m128i;
+
+            static Reg load(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            static Reg eq(Reg v, char c) { return _mm_cmpeq_epi8(v, _mm_set1_epi8(c)); }
+            static unsigned mask(Reg v) { return static_cast<unsigned>(_mm_movemask_epi8(v)); }
+
+            // ' ' or '\t'..'\r', the range check is done as an unsigned min
+            static unsigned space(Reg v)
+            {
+                Reg ctl{ _mm_sub_epi8(v, _mm_set1_epi8('\t')) };
+                Reg inRange{ _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8('\r' - '\t')), ctl) };
+                return mask(_mm_or_si128(eq(v, ' '), inRange));
+            }
+            static constexpr unsigned ALL = 0xFFFFu;
+        };
+#endif
+    }
+
+    const char* findChar(const char* p, const char* end, char c)
+    {
+#if defined(SCANNER_AVX2) || defined(SCANNER_SSE2)
+        for (; end - p >= static_cast<std::ptrdiff_t>(Vec::WIDTH); p += Vec::WIDTH)
+        {
+            unsigned m{ Vec::mask(Vec::eq(Vec::load(p), c)) };
+            if (m)
+                return p + lowestBit(m);
+        }
+#endif
+        for (; p != end; ++p)
+            if (*p == c)
+                return p;
+        return end;
+    }
+
+    const char* findComment(const char* p, const char* end)
+    {
+#if defined(SCANNER_AVX2) || defined(SCANNER_SSE2)
+        // Compare the block and the block shifted by one so a "//"
+        // straddling two blocks is still found.
+        for (; end - p > static_cast<std::ptrdiff_t>(Vec::WIDTH); p += Vec::WIDTH)
+        {
+            unsigned m{ Vec::mask(Vec::eq(Vec::load(p), '/')) & Vec::mask(Vec::eq(Vec::load(p + 1), '/')) };
+            if (m)
+                return p + lowestBit(m);
+        }
+#endif
+        for (; end - p > 1; ++p)
+            if (p[0] == '/' && p[1] == '/')
+                return p;
+        return end;
+    }
+
+    const char* findSpace(const char* p, const char* end)
+    {
+#if defined(SCANNER_AVX2) || defined(SCANNER_SSE2)
+        for (; end - p >= static_cast<std::ptrdiff_t>(Vec::WIDTH); p += Vec::WIDTH)
+        {
+            unsigned m{ Vec::space(Vec::load(p)) };
+            if (m)
+                return p + lowestBit(m);
+        }
+#endif
+        for (; p != end; ++p)
+            if (isSpace(*p))
+                return p;
+        return end;
+    }
+
+    const char* skipSpace(const char* p, const char* end)
+    {
+#if defined(SCANNER_AVX2) || defined(SCANNER_SSE2)
+        for (; end - p >= static_cast<std::ptrdiff_t>(Vec::WIDTH); p += Vec::WIDTH)
+        {
+            unsigned m{ ~Vec::space(Vec::load(p)) & Vec::ALL };
+            if (m)
+                return p + lowestBit(m);
+        }
+#endif
+        for (; p != end; ++p)
+            if (!isSpace(*p))
+                return p;
+        return end;
+    }
+
+    const char* rskipSpace(const char* begin, const char* end)
+    {
+        // Trailing whitespace is rarely more than a byte or two
+        while (end != begin && isSpace(end[-1]))
+            --end;
+        return end;
+    }
+
+    const char* isaName()
+    {
+#if defined(SCANNER_AVX2)
+        return "AVX2";
+#elif defined(SCANNER_SSE2)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+}
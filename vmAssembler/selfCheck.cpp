@@ -0,0 +1,189 @@
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "HackEmulator.h"
+#include "SelfCheck.h"
+#include "Utils.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // Mismatching words printed per program
+    constexpr std::size_t MAX_REPORTED = 5;
+
+    constexpr std::size_t STACK_BASE = 256;
+    constexpr std::size_t HEAP_BASE = 2048;
+
+    bool hasVMFiles(const fs::path& dir)
+    {
+        for (const auto& entry : fs::directory_iterator(dir))
+        {
+            if (!entry.is_directory() && utils::isVMFile(entry.path().filename().string()))
+                return true;
+        }
+        return false;
+    }
+
+    /*
+    * Statics by name, as the assembler may place them differently.
+    * Every other variable is the translator's own.
+    */
+    void compareStatics(const HackEmulator& before, const HackEmulator& after,
+        std::vector<std::string>& mismatches)
+    {
+        for (const auto& variable : before.variables())
+        {
+            if (variable.first.find('.') == std::string::npos)
+                continue;
+
+            auto other{ after.variables().find(variable.first) };
+            const std::int16_t a{ before.ram()[variable.second] };
+            const std::int16_t b{ (other != after.variables().end()) ? after.ram()[other->second] : std::int16_t{ 0 } };
+            if (a != b)
+                mismatches.push_back(variable.first + ' ' + std::to_string(a) + " at -O0, " + std::to_string(b) + " optimized");
+        }
+    }
+
+    /*
+    * SP LCL ARG THIS THAT, temp, the whole stack and everything from
+    * the heap on. Return addresses are ROM addresses and are skipped
+    * by walking the saved LCL chain down from the current frame. Array
+    * fusion leaves THAT and temp 0 unwritten when nothing reads them,
+    * so with it on those and the THAT saved in each frame are skipped.
+    */
+    void compareRam(const HackEmulator& before, const HackEmulator& after, bool arrayFusion,
+        std::vector<std::string>& mismatches)
+    {
+        const std::int16_t* const ram{ before.ram() };
+        const std::size_t sp{ static_cast<std::uint16_t>(ram[0]) };
+
+        std::vector<bool> skipped(HackEmulator::RAM_SIZE);
+        for (std::size_t address = 13; address < STACK_BASE; ++address)
+            skipped[address] = true;
+        skipped[4] = skipped[5] = arrayFusion;
+
+        // Frames sit below each other, a saved LCL that does not go
+        // down is the bootstrap's and ends the walk
+        for (std::size_t frame{ static_cast<std::uint16_t>(ram[1]) }; frame >= STACK_BASE + 5 && frame <= sp;)
+        {
+            skipped[frame - 5] = true;
+            if (arrayFusion)
+                skipped[frame - 1] = true;
+
+            const std::size_t saved{ static_cast<std::uint16_t>(ram[frame - 4]) };
+            if (saved >= frame)
+                break;
+            frame = saved;
+        }
+
+        for (std::size_t address = 0; address < HackEmulator::RAM_SIZE; ++address)
+        {
+            const bool compared{ !skipped[address] && (address < sp || address >= HEAP_BASE) };
+            if (compared && before.ram()[address] != after.ram()[address])
+                mismatches.push_back("RAM[" + std::to_string(address) + "] " + std::to_string(before.ram()[address])
+                    + " at -O0, " + std::to_string(after.ram()[address]) + " optimized");
+        }
+    }
+
+    bool checkProgram(const fs::path& program, const TranslatorOptions& options, std::uint64_t maxCycles)
+    {
+        const std::string name{ program.filename().string() };
+        const fs::path plainPath{ fs::temp_directory_path() / (name + ".O0.asm") };
+        const fs::path optimizedPath{ fs::temp_directory_path() / (name + ".opt.asm") };
+
+        TranslatorOptions plain{ options };
+        plain.passes.setLevel(0);
+        plain.optimizeSize = false;
+        plain.profilePath.clear();
+        plain.outputPath = plainPath.string();
+        plain.verbose = false;
+
+        TranslatorOptions optimized{ options };
+        optimized.outputPath = optimizedPath.string();
+        optimized.verbose = false;
+
+        if (!translate_VM_files(program.string(), plain) || !translate_VM_files(program.string(), optimized))
+        {
+            std::cout << "FAIL " << name << ": translation failed" << '\n';
+            return false;
+        }
+
+        try
+        {
+            HackEmulator before{ plainPath.string() };
+            HackEmulator after{ optimizedPath.string() };
+            const std::uint64_t beforeCycles{ before.run(maxCycles) };
+            const std::uint64_t afterCycles{ after.run(maxCycles) };
+
+            if (!before.halted() || !after.halted())
+            {
+                std::cout << "FAIL " << name << ": did not halt within " << maxCycles << " cycles" << '\n';
+                return false;
+            }
+
+            std::vector<std::string> mismatches{};
+            compareStatics(before, after, mismatches);
+            compareRam(before, after, optimized.passes.enabled(PassManager::Pass::ARRAY_FUSION), mismatches);
+            if (!mismatches.empty())
+            {
+                std::cout << "FAIL " << name << ':' << '\n';
+                for (std::size_t i = 0; i < mismatches.size() && i < MAX_REPORTED; ++i)
+                    std::cout << "  " << mismatches[i] << '\n';
+                std::cout << "  " << mismatches.size() << " words differ" << '\n';
+                return false;
+            }
+
+            // -Os may give up speed but never size, budget met or not
+            if (optimized.optimizeSize)
+            {
+                TranslatorOptions inlined{ optimized };
+                inlined.optimizeSize = false;
+                inlined.outputPath = (fs::temp_directory_path() / (name + ".inline.asm")).string();
+                const std::size_t inlinedSize{ translateProgram(program.string(), inlined).romSize };
+                if (after.romSize() > inlinedSize)
+                {
+                    std::cout << "FAIL " << name << ": -Os grew the program from " << inlinedSize << " to "
+                        << after.romSize() << " words" << '\n';
+                    return false;
+                }
+            }
+
+            std::cout << "PASS " << name << ": " << beforeCycles << " -> " << afterCycles << " cycles, "
+                << before.romSize() << " -> " << after.romSize() << " words" << '\n';
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            std::cout << "FAIL " << name << ": " << e.what() << '\n';
+            return false;
+        }
+    }
+}
+
+bool selfCheck(const std::string& corpus, const TranslatorOptions& options, std::uint64_t maxCycles)
+{
+    std::vector<fs::path> programs{};
+    if (!fs::is_directory(corpus) || hasVMFiles(corpus))
+        programs.push_back(fs::absolute(corpus));
+    else
+    {
+        for (const auto& entry : fs::directory_iterator(corpus))
+        {
+            if (entry.is_directory() && hasVMFiles(entry.path()))
+                programs.push_back(fs::absolute(entry.path()));
+        }
+        std::sort(programs.begin(), programs.end());
+    }
+
+    std::size_t passed{ 0 };
+    for (const auto& program : programs)
+        passed += checkProgram(program, options, maxCycles);
+
+    std::cout << passed << " of " << programs.size() << " programs match" << '\n';
+    return !programs.empty() && passed == programs.size();
+}
@@ -0,0 +1,204 @@
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <vector>
+
+#include "SizeOptimizer.h"
+
+namespace
+{
+    using SiteKind = CodeWriter::SiteKind;
+
+    /*
+    * A site is hot when it lies between a label and a later jump back
+    * to it. Sites are recorded in address order so one sweep is enough.
+    */
+    std::vector<bool> findHotSites(const CodeWriter::Layout& layout)
+    {
+        std::vector<std::size_t> begins, ends;
+        for (const auto& loop : layout.loops)
+        {
+            begins.push_back(loop.first);
+            ends.push_back(loop.second);
+        }
+        std::sort(begins.begin(), begins.end());
+        std::sort(ends.begin(), ends.end());
+
+        std::vector<bool> hot(layout.sites.size());
+        std::size_t opened{ 0 }, closed{ 0 };
+        for (std::size_t i = 0; i < layout.sites.size(); ++i)
+        {
+            const std::size_t address{ layout.sites[i].address };
+            while (opened < begins.size() && begins[opened] <= address)
+                ++opened;
+            while (closed < ends.size() && ends[closed] < address)
+                ++closed;
+            hot[i] = opened > closed;
+        }
+        return hot;
+    }
+
+    std::size_t routineIndex(const CodeWriter::Site& site)
+    {
+        switch (site.kind)
+        {
+        case SiteKind::CALL:
+            return 0;
+        case SiteKind::RETURN:
+            return 1;
+        case SiteKind::COMPARISON:
+        default:
+            return 2 + static_cast<std::size_t>(site.variant);
+        }
+    }
+
+    CodeWriter::SizePlan toPlan(const CodeWriter::Layout& layout, const std::vector<bool>& shared)
+    {
+        CodeWriter::SizePlan plan{};
+        for (std::size_t i = 0; i < layout.sites.size(); ++i)
+        {
+            switch (layout.sites[i].kind)
+            {
+            case SiteKind::CALL:
+                plan.sharedCalls.push_back(shared[i]);
+                break;
+            case SiteKind::COMPARISON:
+                plan.sharedComparisons.push_back(shared[i]);
+                break;
+            case SiteKind::RETURN:
+                plan.sharedReturns.push_back(shared[i]);
+                break;
+            }
+        }
+        return plan;
+    }
+}
+
+CodeWriter::SizePlan planForBudget(const CodeWriter::Layout& layout, std::size_t romSize, std::size_t budget,
+    const std::vector<bool>& profileHot)
+{
+    const std::vector<bool> hot{ profileHot.empty() ? findHotSites(layout) : profileHot };
+
+    std::vector<std::size_t> order(layout.sites.size());
+    std::iota(order.begin(), order.end(), 0);
+    order.erase(std::remove_if(order.begin(), order.end(), [&](std::size_t i) {
+        return layout.sites[i].size <= layout.sites[i].sharedSize;
+        }), order.end());
+
+    // Like planForProfile, a routine is only used when all the sites
+    // that could go through it save more than the routine takes
+    std::size_t saving[5]{};
+    for (std::size_t i : order)
+        saving[routineIndex(layout.sites[i])] += layout.sites[i].size - layout.sites[i].sharedSize;
+    order.erase(std::remove_if(order.begin(), order.end(), [&](std::size_t i) {
+        return saving[routineIndex(layout.sites[i])] <= CodeWriter::routineSize(layout.sites[i].kind);
+        }), order.end());
+
+    // Cold before hot, biggest saving first, source order breaks ties
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        const auto& sa{ layout.sites[a] };
+        const auto& sb{ layout.sites[b] };
+        if (hot[a] != hot[b])
+            return !hot[a];
+        return sa.size - sa.sharedSize > sb.size - sb.sharedSize;
+        });
+
+    std::vector<bool> shared(layout.sites.size());
+    bool routineUsed[5]{};
+    std::size_t size{ romSize };
+
+    for (std::size_t i : order)
+    {
+        if (size <= budget)
+            break;
+
+        const auto& site{ layout.sites[i] };
+        const std::size_t routine{ routineIndex(site) };
+        if (!routineUsed[routine])
+        {
+            routineUsed[routine] = true;
+            size += CodeWriter::routineSize(site.kind);
+        }
+        size -= site.size - site.sharedSize;
+        shared[i] = true;
+    }
+
+    // Out of reach or not, the program never grows
+    if (size >= romSize)
+        return {};
+    return toPlan(layout, shared);
+}
+
+std::vector<bool> profileHotSites(const CodeWriter::Layout& layout, const Profile& profile)
+{
+    std::vector<bool> hot(layout.sites.size());
+    for (std::size_t i = 0; i < layout.sites.size(); ++i)
+    {
+        const auto& site{ layout.sites[i] };
+        const SymbolTable::Id function{ layout.functions[site.function].name };
+        hot[i] = profile.isHot(function)
+            && (site.kind != SiteKind::CALL || profile.calls(function, site.callee) != 0);
+    }
+    return hot;
+}
+
+CodeWriter::SizePlan planForProfile(const CodeWriter::Layout& layout, const std::vector<bool>& hot)
+{
+    std::size_t saving[5]{};
+    for (std::size_t i = 0; i < layout.sites.size(); ++i)
+    {
+        const auto& site{ layout.sites[i] };
+        if (!hot[i] && site.size > site.sharedSize)
+            saving[routineIndex(site)] += site.size - site.sharedSize;
+    }
+
+    std::vector<bool> shared(layout.sites.size());
+    for (std::size_t i = 0; i < layout.sites.size(); ++i)
+    {
+        const auto& site{ layout.sites[i] };
+        shared[i] = !hot[i] && site.size > site.sharedSize
+            && saving[routineIndex(site)] > CodeWriter::routineSize(site.kind);
+    }
+    return toPlan(layout, shared);
+}
+
+void writeSizeReport(std::ostream& out, const CodeWriter::Layout& layout, const SymbolTable& symbols,
+    std::size_t romSize, std::size_t budget, std::size_t top)
+{
+    struct Counts
+    {
+        std::size_t inlined[3]{};
+        std::size_t shared[3]{};
+    };
+
+    std::vector<Counts> counts(layout.functions.size());
+    for (const auto& site : layout.sites)
+    {
+        Counts& c{ counts[site.function] };
+        ++(site.shared ? c.shared : c.inlined)[static_cast<int>(site.kind)];
+    }
+
+    std::vector<std::size_t> order(layout.functions.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return layout.functions[a].size > layout.functions[b].size;
+        });
+    order.resize(std::min(top, order.size()));
+
+    out << "ROM usage: " << romSize << " / " << budget << " words";
+    if (romSize > budget)
+        out << " (over budget by " << romSize - budget << ')';
+    out << '\n';
+
+    out << "Largest functions (sites inline/shared):\n";
+    for (std::size_t i : order)
+    {
+        const auto& f{ layout.functions[i] };
+        const Counts& c{ counts[i] };
+        out << "  " << std::left << std::setw(32) << symbols[f.name] << std::right << std::setw(6) << f.size << " words"
+            << "  calls " << c.inlined[0] << '/' << c.shared[0]
+            << "  comparisons " << c.inlined[1] << '/' << c.shared[1]
+            << "  returns " << c.inlined[2] << '/' << c.shared[2] << '\n';
+    }
+}
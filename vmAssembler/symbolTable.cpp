@@ -0,0 +1,80 @@
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include "SymbolTable.h"
+
+
+SymbolTable::SymbolTable()
+    : mBlocks{}
+    , mBlockUsed{ 0 }
+    , mBlockCapacity{ 0 }
+    , mNames{}
+    , mIndex{}
+    , mQualified{}
+    , mScratch{}
+{
+}
+
+std::string_view SymbolTable::store(std::string_view name)
+{
+    if (mBlocks.empty() || mBlockUsed + name.size() > mBlockCapacity)
+    {
+        // Oversized names get a block of their own
+        mBlockCapacity = std::max(BLOCK_SIZE, name.size());
+        mBlocks.emplace_back(new char[mBlockCapacity]);
+        mBlockUsed = 0;
+    }
+
+    char* dest{ mBlocks.back().get() + mBlockUsed };
+    if (!name.empty())
+        std::memcpy(dest, name.data(), name.size());
+    mBlockUsed += name.size();
+    return { dest, name.size() };
+}
+
+SymbolTable::Id SymbolTable::intern(std::string_view name)
+{
+    auto found{ mIndex.find(name) };
+    if (found != mIndex.end())
+        return found->second;
+
+    Id id{ static_cast<Id>(mNames.size()) };
+    std::string_view stored{ store(name) };
+    mNames.push_back(stored);
+    mIndex.emplace(stored, id);
+    return id;
+}
+
+SymbolTable::Id SymbolTable::qualify(Id scope, char sep, Id name)
+{
+    QualKey key{ scope, name, sep, false };
+    auto found{ mQualified.find(key) };
+    if (found != mQualified.end())
+        return found->second;
+
+    mScratch.assign(mNames[scope]);
+    mScratch += sep;
+    mScratch += mNames[name];
+
+    Id id{ intern(mScratch) };
+    mQualified.emplace(key, id);
+    return id;
+}
+
+SymbolTable::Id SymbolTable::qualify(Id scope, char sep, int index)
+{
+    QualKey key{ scope, static_cast<std::uint32_t>(index), sep, true };
+    auto found{ mQualified.find(key) };
+    if (found != mQualified.end())
+        return found->second;
+
+    mScratch.assign(mNames[scope]);
+    mScratch += sep;
+    mScratch += std::to_string(index);
+
+    Id id{ intern(mScratch) };
+    mQualified.emplace(key, id);
+    return id;
+}
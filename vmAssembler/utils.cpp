@@ -1,10 +1,12 @@
 #include <algorithm>
 #include <cctype>
+#include <charconv>
 #include <string>
 #include <map>
 
 #include "Utils.h"
 #include "Parser.h"
+#include "Scanner.h"
 
 namespace utils
 {
@@ -23,38 +25,79 @@ namespace utils
 
     void ltrim(std::string& s)
     {
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
-            return !std::isspace(ch);
-            }));
+        const char* data{ s.data() };
+        s.erase(0, scanner::skipSpace(data, data + s.size()) - data);
     }
 
     // trim from end (in place)
     void rtrim(std::string& s)
     {
-        s.erase(std::find_if(s.rbegin(), s.rend(), [](unsigned char ch) {
-            return !std::isspace(ch);
-            }).base(), s.end());
+        const char* data{ s.data() };
+        s.erase(scanner::rskipSpace(data, data + s.size()) - data);
     }
 
     // trim from both ends (in place)
     void trim(std::string& s)
     {
-        ltrim(s);
         rtrim(s);
+        ltrim(s);
     }
 
     void removeComments(std::string& s)
     {
-        ltrim(s);
-        auto res = std::find(s.begin(), s.end(), '/');
+        // Cut the comment before trimming so each side is erased once
+        const char* data{ s.data() };
+        s.erase(scanner::findComment(data, data + s.size()) - data);
+        trim(s);
+    }
 
-        if (res != s.end())
-            s.erase(res, s.end());
+    bool isValidIndex(std::string_view segment, int index)
+    {
+        if (segment == "temp")
+            return index >= 0 && index < 8;
+        if (segment == "pointer")
+            return index >= 0 && index < 2;
+        return index >= 0;
+    }
 
-        rtrim(s);
+    std::string_view trim(std::string_view s)
+    {
+        const char* first{ scanner::skipSpace(s.data(), s.data() + s.size()) };
+        const char* last{ scanner::rskipSpace(first, s.data() + s.size()) };
+        return { first, static_cast<std::size_t>(last - first) };
+    }
+
+    std::string_view removeComments(std::string_view s)
+    {
+        const char* first{ scanner::skipSpace(s.data(), s.data() + s.size()) };
+        const char* last{ scanner::rskipSpace(first, scanner::findComment(first, s.data() + s.size())) };
+        return { first, static_cast<std::size_t>(last - first) };
+    }
+
+    int toInt(std::string_view s)
+    {
+        int value{ 0 };
+        bool negative{ !s.empty() && s.front() == '-' };
+        if (negative)
+            s.remove_prefix(1);
+
+        for (char c : s)
+        {
+            if (c < '0' || c > '9')
+                break;
+            value = value * 10 + (c - '0');
+        }
+        return negative ? -value : value;
+    }
+
+    void appendInt(std::pmr::string& s, int value)
+    {
+        char buf[16];
+        auto res{ std::to_chars(buf, buf + sizeof(buf), value) };
+        s.append(buf, res.ptr);
     }
 
-    std::map<std::string, Parser::Command> commandMap{
+    std::map<std::string, Parser::Command, std::less<>> commandMap{
         { "pop", Parser::Command::C_POP },
         { "push", Parser::Command::C_PUSH },
         { "add", Parser::Command::C_ARITHMETIC_BI },
@@ -74,7 +117,7 @@ namespace utils
         { "call", Parser::Command::C_CALL },
     };
 
-    std::map<std::string, std::string> symbolMap{
+    std::map<std::string, std::string, std::less<>> symbolMap{
         { "add", "+" },
         { "sub", "-" },
         { "neg", "-" },
@@ -86,7 +129,7 @@ namespace utils
         { "lt", "JLT" },
     };
 
-    std::map<std::string, std::string> segmentMap{
+    std::map<std::string, std::string, std::less<>> segmentMap{
         { "argument", "ARG" },
         { "local", "LCL" },
         { "this", "THIS" },
@@ -1,13 +1,138 @@
+
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "Batch.h"
+#include "Benchmark.h"
+#include "Interpreter.h"
+#include "SelfCheck.h"
 #include "VMTranslator.h"
+#include "Watcher.h"
+
+// Emulated cycles per program for --self-check without --max-steps
+constexpr std::uint64_t SELF_CHECK_CYCLES = 100'000'000;
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
-        std::cout << "Usage: " << argv[0] << "   <filename>\n";
+    TranslatorOptions options{};
+    std::vector<std::string> paths{};
+    bool valid{ true };
+    bool benchScan{ false };
+    bool run{ false };
+    bool check{ false };
+    bool watch{ false };
+    bool batch{ false };
+    std::string manifest{};
+    unsigned jobs{ 0 };
+    int level{ PassManager::DEFAULT_LEVEL };
+    std::vector<std::pair<std::string, bool>> toggles{};
+    std::uint64_t maxSteps{ UINT64_MAX };
+    int dumpBegin{ 0 }, dumpEnd{ 0 };
+    std::string profileOut{};
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg{ argv[i] };
+
+        // Numbers that do not fit their option make the command line invalid
+        try
+        {
+            // -j uses one parsing thread per core, -jN uses N
+            if (arg.rfind("-j", 0) == 0 && arg.find_first_not_of("0123456789", 2) == std::string::npos)
+                options.parseThreads = (arg.size() > 2) ? std::stoul(arg.substr(2)) : 0;
+            else if (arg == "--bench-scan")
+                benchScan = true;
+            else if (arg == "-Os")
+                options.optimizeSize = true;
+            else if (arg.rfind("--rom-budget=", 0) == 0 && arg.size() > 13
+                && arg.find_first_not_of("0123456789", 13) == std::string::npos)
+                options.romBudget = std::stoul(arg.substr(13));
+            else if (arg.size() == 3 && arg.rfind("-O", 0) == 0 && arg[2] >= '0' && arg[2] <= '0' + PassManager::MAX_LEVEL)
+                level = arg[2] - '0';
+            // -fname / -fno-name switch single passes, whatever the -O level
+            else if (arg.rfind("-fno-", 0) == 0)
+                toggles.emplace_back(arg.substr(5), false);
+            else if (arg.rfind("-f", 0) == 0)
+                toggles.emplace_back(arg.substr(2), true);
+            // --profile-generate=FILE with --run writes the profile that
+            // --profile-use=FILE translates with
+            else if (arg.rfind("--profile-generate=", 0) == 0 && arg.size() > 19)
+                profileOut = arg.substr(19);
+            else if (arg.rfind("--profile-use=", 0) == 0 && arg.size() > 14)
+                options.profilePath = arg.substr(14);
+            // --batch takes any number of programs, --jobs=N sets the
+            // programs translated at once
+            else if (arg == "--batch")
+                batch = true;
+            else if (arg.rfind("--manifest=", 0) == 0 && arg.size() > 11)
+            {
+                manifest = arg.substr(11);
+                batch = true;
+            }
+            else if (arg.rfind("--jobs=", 0) == 0 && arg.size() > 7
+                && arg.find_first_not_of("0123456789", 7) == std::string::npos)
+                jobs = std::stoul(arg.substr(7));
+            else if (arg == "--watch")
+                watch = true;
+            else if (arg == "--self-check")
+                check = true;
+            else if (arg == "--run")
+                run = true;
+            else if (arg.rfind("--max-steps=", 0) == 0 && arg.size() > 12
+                && arg.find_first_not_of("0123456789", 12) == std::string::npos)
+                maxSteps = std::stoull(arg.substr(12));
+            // --ram=A-B prints RAM[A..B] after --run
+            else if (arg.rfind("--ram=", 0) == 0 && arg.find('-', 6) != std::string::npos
+                && arg.find_first_not_of("0123456789-", 6) == std::string::npos)
+            {
+                const std::size_t dash{ arg.find('-', 6) };
+                dumpBegin = std::stoi(arg.substr(6, dash - 6));
+                dumpEnd = std::stoi(arg.substr(dash + 1)) + 1;
+            }
+            else
+                paths.push_back(arg);
+        }
+        catch (const std::exception&)
+        {
+            valid = false;
+        }
+    }
+
+    if (!batch && paths.size() != 1)
+        valid = false;
+    const std::string path{ paths.empty() ? std::string{} : paths.front() };
+
+    options.passes.setLevel(level);
+    for (const auto& toggle : toggles)
+        valid = options.passes.setEnabled(toggle.first, toggle.second) && valid;
+
+    if (!valid || (paths.empty() && manifest.empty()))
+        std::cout << "Usage: " << argv[0] << " [-j[N]] [-O0|-O1|-O2] [-f[no-]<pass>] [-Os] [--rom-budget=N]\n"
+            << "           [--profile-use=FILE] <filename>\n"
+            << "       " << argv[0] << " --batch [--jobs=N] [--manifest=FILE] [options] <program>...\n"
+            << "       " << argv[0] << " --watch [-O0|-O1|-O2] [-f[no-]<pass>] <filename>\n"
+            << "       " << argv[0] << " --self-check [-O1|-O2] [-f[no-]<pass>] [-Os] [--profile-use=FILE] [--max-steps=N] <corpus>\n"
+            << "       " << argv[0] << " --run [-j[N]] [--max-steps=N] [--ram=A-B] [--profile-generate=FILE] <filename>\n"
+            << "       " << argv[0] << " --bench-scan <filename>\n"
+            << "Passes: jump-threading, array-fusion, math-inline, const-assign, lean-return\n"
+            << "-O1 is the default, -O2 adds array-fusion and math-inline\n"
+            << "The programs under corpus/ are meant for --self-check, e.g. --self-check -O2 corpus\n";
+    else if (batch)
+        return batch_translate(paths, manifest, options, jobs) ? 0 : 1;
+    else if (benchScan)
+        benchmarkScanner(path);
+    else if (run)
+        interpret_VM_files(path, options.parseThreads, maxSteps, dumpBegin, dumpEnd, profileOut);
+    else if (watch)
+        watch_VM_files(path, options);
+    else if (check)
+        return selfCheck(path, options, (maxSteps == UINT64_MAX) ? SELF_CHECK_CYCLES : maxSteps) ? 0 : 1;
     else
-        translate_VM_files({ argv[1] });
+        translate_VM_files(path, options);
 
     return 0;
 }
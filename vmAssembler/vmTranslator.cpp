@@ -1,29 +1,46 @@
+#include <algorithm>
 #include <filesystem>
 #include <string>
 #include <iostream>
-#include <sstream>
+#include <memory_resource>
+#include <optional>
 #include <vector>
 
+#include "Arena.h"
 #include "CodeWriter.h"
 #include "Parser.h"
+#include "Profile.h"
+#include "SizeOptimizer.h"
+#include "SymbolTable.h"
 #include "Utils.h"
 #include "VMTranslator.h"
 
 namespace fs = std::filesystem;
 
-void translateVMFile(const std::string& name, CodeWriter& cwriter)
+void translateVMFile(const std::string& name, CodeWriter& cwriter, SymbolTable& symbols,
+    Arena& arena, const TranslatorOptions& options, PassManager& passes)
 {
-    Parser parser{ name };
+    arena.reset();
+    Parser parser{ name, symbols, options.parseThreads, &arena };
+    passes.run(parser.instructions(), symbols);
+    cwriter.reserveLayout(parser.instructions());
 
-    std::cout << "Translating " << fs::path(name).filename().string() << '\n';
+    if (options.verbose)
+        std::cout << "Translating " << fs::path(name).filename().string() << '\n';
 
     while (parser.hasMoreLines())
     {
         parser.advance();
         Parser::Command cmd{ parser.commandType() };
-        std::string arg1{};
+        std::string_view arg1{};
+        SymbolTable::Id symbol{};
 
-        if (cmd != Parser::Command::C_RETURN)
+        // Labels and function names are interned once and passed by id
+        if (cmd == Parser::Command::C_CALL || cmd == Parser::Command::C_GOTO ||
+            cmd == Parser::Command::C_IF || cmd == Parser::Command::C_LABEL ||
+            cmd == Parser::Command::C_FUNCTION)
+            symbol = parser.arg1Symbol();
+        else
             arg1 = parser.arg1();
 
         switch (cmd)
@@ -32,27 +49,44 @@ void translateVMFile(const std::string& name, CodeWriter& cwriter)
         case Parser::Command::C_CALL:
             arg2 = parser.arg2();
             cwriter.writeComment(parser.returnCommand());
-            cwriter.writeCall(arg1, arg2);
+            cwriter.writeCall(symbol, arg2);
             break;
         case Parser::Command::C_GOTO:
             cwriter.writeComment(parser.returnCommand());
-            cwriter.writeGoto(arg1);
+            cwriter.writeGoto(symbol);
             break;
         case Parser::Command::C_IF:
             cwriter.writeComment(parser.returnCommand());
-            cwriter.writeIf(arg1);
+            cwriter.writeIf(symbol);
             break;
         case Parser::Command::C_LABEL:
-            cwriter.writeLabel(arg1);
+            cwriter.writeLabel(symbol);
             break;
         case Parser::Command::C_FUNCTION:
             arg2 = parser.arg2();
-            cwriter.writeFunction(arg1, arg2);
+            cwriter.writeFunction(symbol, arg2);
             break;
         case Parser::Command::C_RETURN:
-            cwriter.writeComment(parser.returnCommand());
-            cwriter.writeReturn();
+        {
+            const int keeps{ parser.arg3() };
+            const bool restoreThis{ !(keeps & Parser::RETURN_KEEPS_THIS) };
+            const bool restoreThat{ !(keeps & Parser::RETURN_KEEPS_THAT) };
+
+            if (arg1 == "constant")
+            {
+                arg2 = parser.arg2();
+                std::pmr::string s{ "return constant ", &arena };
+                utils::appendInt(s, arg2);
+                cwriter.writeComment(s);
+                cwriter.writeReturnConstant(arg2, restoreThis, restoreThat);
+            }
+            else
+            {
+                cwriter.writeComment(parser.returnCommand());
+                cwriter.writeReturn(restoreThis, restoreThat);
+            }
             break;
+        }
         case Parser::Command::C_ARITHMETIC_BI:
         case Parser::Command::C_ARITHMETIC_UN:
         case Parser::Command::C_COMPARISON:
@@ -62,27 +96,52 @@ void translateVMFile(const std::string& name, CodeWriter& cwriter)
         case Parser::Command::C_PUSH:
         case Parser::Command::C_POP:
             arg2 = parser.arg2();
-            if (arg1 == "constant" && parser.peekNxtCommandType() == Parser::Command::C_POP)
-            {
-                // This is a straight assignment syntax of assigning a
-                // constant value to a place in memory so we can optimize
-                // the generated code by bypassing the stack as a whole,
-                // assigning the constant value to be pushed directly to memory
-                // N.B. Assignment/Pushing from another value in memory creates
-                // more complications and is handled the normal way.
-                parser.advance();
-                auto seg_pop{ parser.arg1() };
-                auto arg2_pop{ parser.arg2() };
-                std::stringstream s;
-                s << "assignment " << arg1 << ' ' << arg2 << " to " << seg_pop << ' ' << arg2_pop;
-                cwriter.writeComment(s.str());
-                cwriter.opt_assignment_op(arg2, seg_pop, arg2_pop);
-            }
-            else
-            {
-                cwriter.writeComment(parser.returnCommand());
-                cwriter.writePushPop(cmd, arg1, arg2);
-            }
+            cwriter.writeComment(parser.returnCommand());
+            cwriter.writePushPop(cmd, arg1, arg2);
+            break;
+        case Parser::Command::C_ASSIGN:
+        {
+            // This is a straight assignment syntax of assigning a
+            // constant value to a place in memory so we can optimize
+            // the generated code by bypassing the stack as a whole,
+            // assigning the constant value to be pushed directly to memory
+            // N.B. Assignment/Pushing from another value in memory creates
+            // more complications and is handled the normal way.
+            arg2 = parser.arg2();
+            const int value{ parser.arg3() };
+            std::pmr::string s{ "assignment constant ", &arena };
+            utils::appendInt(s, value);
+            s.append(" to ").append(arg1).append(1, ' ');
+            utils::appendInt(s, arg2);
+            cwriter.writeComment(s);
+            cwriter.opt_assignment_op(value, arg1, arg2);
+            break;
+        }
+        case Parser::Command::C_MULTIPLY:
+        {
+            arg2 = parser.arg2();
+            std::pmr::string s{ "multiply by constant ", &arena };
+            utils::appendInt(s, arg2);
+            cwriter.writeComment(s);
+            cwriter.writeMultiply(arg2);
+            break;
+        }
+        case Parser::Command::C_DIVIDE:
+        {
+            arg2 = parser.arg2();
+            std::pmr::string s{ "divide by constant ", &arena };
+            utils::appendInt(s, arg2);
+            cwriter.writeComment(s);
+            cwriter.writeDivide(arg2);
+            break;
+        }
+        case Parser::Command::C_ARRAY_READ:
+            cwriter.writeComment("array read");
+            cwriter.writeArrayRead(parser.arg2() != 0);
+            break;
+        case Parser::Command::C_ARRAY_WRITE:
+            cwriter.writeComment("array write");
+            cwriter.writeArrayWrite(parser.arg2() != 0, parser.arg3() != 0);
             break;
         case Parser::Command::C_NOT_IMPLEMENTED:
         default:
@@ -90,18 +149,23 @@ void translateVMFile(const std::string& name, CodeWriter& cwriter)
         }
     }
     cwriter.writeInfiniteLoop();
-    std::cout << "Finished Translating " << fs::path(name).filename().string() << '\n';
+    if (options.verbose)
+        std::cout << "Finished Translating " << fs::path(name).filename().string() << '\n';
 }
 
-void translate_VM_files(const std::string& f)
+std::vector<std::string> collectVMFiles(const std::string& f, std::string& asmName, bool verbose)
 {
     std::vector<std::string> files{};
-    std::string fName{};
 
     if (fs::is_directory(fs::absolute(f)))
     {
-        fName = fs::absolute(f).string() + "\\" + fs::path(f).replace_extension(".asm").string();
-        std::cout << "Finding '.vm' files in current directory..." << '\n' << '\n';
+        // dir/ has an empty file name, the program is named after dir
+        fs::path dir{ fs::absolute(f) };
+        if (!dir.has_filename())
+            dir = dir.parent_path();
+        asmName = (dir / (dir.filename().string() + ".asm")).string();
+        if (verbose)
+            std::cout << "Finding '.vm' files in current directory..." << '\n' << '\n';
 
         for (const auto& entry : fs::directory_iterator(f))
         {
@@ -111,30 +175,116 @@ void translate_VM_files(const std::string& f)
     }
     else if (fs::exists(f))
     {
-        fName = fs::path(f).replace_extension(".asm").string();
+        asmName = fs::path(f).replace_extension(".asm").string();
         if (utils::isVMFile(fs::path(f).filename().string()))
             files.push_back(fs::absolute(f).string());
     }
 
-    if (files.empty())
-    {
+    // Directory order differs between systems, the output should not
+    std::sort(files.begin(), files.end());
+
+    if (files.empty() && verbose)
         std::cout << "Did not find any '.vm' file in current directory..." << '\n';
-        return;
-    }
+    return files;
+}
 
-    try
-    {
-        CodeWriter cwriter{ fName };
+TranslationStats translateProgram(const std::string& f, const TranslatorOptions& options)
+{
+    TranslationStats stats{};
+    std::string fName{};
+    const std::vector<std::string> files{ collectVMFiles(f, fName, options.verbose) };
+    if (files.empty())
+        return stats;
+    if (!options.outputPath.empty())
+        fName = options.outputPath;
+
+    stats.files = files.size();
+    for (const auto& g : files)
+        stats.bytes += fs::file_size(g);
 
+    SymbolTable symbols{};
+    Arena arena{};
+    CodeWriter cwriter{ fName, symbols };
+    PassManager passes{ options.passes };
+    passes.setOptimizeSize(options.optimizeSize);
+
+    std::optional<Profile> profile{};
+    if (!options.profilePath.empty())
+        profile.emplace(options.profilePath, symbols);
+    cwriter.collectFunctions(profile.has_value());
+
+    auto translateAll{ [&]() {
+        passes.resetStats();
         for (const auto& g : files)
         {
             cwriter.setFileName(g);
-            translateVMFile(g, cwriter);
+            translateVMFile(g, cwriter, symbols, arena, options, passes);
         }
+    } };
+    translateAll();
+
+    // Sizes are only known once everything has been written inline,
+    // so a program over budget is written a second time with the
+    // sites picked by the planner going through shared routines.
+    // With a profile the cold sites are always moved, over budget
+    // the planner takes the profile's idea of hot instead of loops.
+    if (profile)
+    {
+        const std::vector<bool> hot{ profileHotSites(cwriter.layout(), *profile) };
+        const bool overBudget{ options.optimizeSize && cwriter.romSize() > options.romBudget };
+        if (options.verbose)
+            std::cout << '\n' << "Profile: " << profile->hotFunctions().size() << " hot functions, "
+                << std::count(hot.begin(), hot.end(), true) << " of " << hot.size()
+                << " sites on hot paths, translating again..." << '\n';
+
+        cwriter.restart(overBudget
+            ? planForBudget(cwriter.layout(), cwriter.romSize(), options.romBudget, hot)
+            : planForProfile(cwriter.layout(), hot));
+        translateAll();
+        cwriter.writeFunctions(profile->hotFunctions());
+    }
+    else if (options.optimizeSize && cwriter.romSize() > options.romBudget)
+    {
+        const CodeWriter::SizePlan plan{ planForBudget(cwriter.layout(), cwriter.romSize(), options.romBudget) };
+        const bool inlined{ plan.sharedCalls.empty() && plan.sharedComparisons.empty() && plan.sharedReturns.empty() };
+        if (options.verbose)
+            std::cout << '\n' << "Over ROM budget by " << cwriter.romSize() - options.romBudget << " words, "
+                << (inlined ? "shared routines would not make it smaller" : "translating again with shared routines...")
+                << '\n';
+        if (!inlined)
+        {
+            cwriter.restart(plan);
+            translateAll();
+        }
+    }
+    cwriter.writeSharedRoutines();
+    stats.romSize = cwriter.romSize();
+
+    if (!options.verbose)
+        return stats;
+
+    passes.writeReport(std::cout);
+    std::cout << "Peak arena usage: " << arena.peak() << " bytes" << '\n';
+
+    if (options.optimizeSize)
+        writeSizeReport(std::cout, cwriter.layout(), symbols, cwriter.romSize(), options.romBudget);
+    else
+        std::cout << "ROM usage: " << cwriter.romSize() << " words" << '\n';
+
+    if (cwriter.romSize() > HACK_ROM_SIZE)
+        std::cout << "Warning: program does not fit in the " << HACK_ROM_SIZE << " word Hack ROM" << '\n';
+    return stats;
+}
+
+bool translate_VM_files(const std::string& f, const TranslatorOptions& options)
+{
+    try
+    {
+        return translateProgram(f, options).files != 0;
     }
     catch (const std::exception& e)
     {
         std::cout << e.what() << '\n';
-        return;
+        return false;
     }
 }
@@ -0,0 +1,169 @@
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "Watcher.h"
+
+namespace fs = std::filesystem;
+
+// How often modification times are looked at
+constexpr std::chrono::milliseconds WATCH_INTERVAL{ 100 };
+
+
+Watcher::Watcher(const std::string& path, const TranslatorOptions& options)
+    : mPath{ path }
+    , mOptions{ options }
+    , mSymbols{}
+    , mArena{}
+    , mPasses{ options.passes }
+    , mBootstrap{}
+    , mBootstrapSize{ 0 }
+    , mWriter{ path, mSymbols, &mBootstrap }
+    , mAsmName{}
+    , mFragments{}
+    , mFailed{}
+{
+    mOptions.verbose = false;
+    mBootstrapSize = mWriter.romSize();
+
+    collectVMFiles(mPath, mAsmName, false);
+    if (!options.outputPath.empty())
+        mAsmName = options.outputPath;
+}
+
+std::size_t Watcher::poll()
+{
+    std::string ignored{};
+    const std::vector<std::string> files{ collectVMFiles(mPath, ignored, false) };
+    std::size_t translated{ 0 };
+    bool changed{ false };
+
+    for (auto it = mFailed.begin(); it != mFailed.end();)
+    {
+        if (!std::binary_search(files.begin(), files.end(), it->first))
+            it = mFailed.erase(it);
+        else
+            ++it;
+    }
+
+    for (auto it = mFragments.begin(); it != mFragments.end();)
+    {
+        if (!std::binary_search(files.begin(), files.end(), it->first))
+        {
+            std::cout << "Removed " << fs::path(it->first).filename().string() << '\n';
+            it = mFragments.erase(it);
+            changed = true;
+        }
+        else
+            ++it;
+    }
+
+    for (const auto& file : files)
+    {
+        // The file may be gone or half written by now, it is
+        // picked up again on the next poll
+        std::error_code error{};
+        const fs::file_time_type time{ fs::last_write_time(file, error) };
+        if (error)
+            continue;
+
+        auto found{ mFragments.find(file) };
+        if (found != mFragments.end() && found->second.time == time)
+            continue;
+        auto failed{ mFailed.find(file) };
+        if (failed != mFailed.end() && failed->second == time)
+            continue;
+
+        const auto start{ std::chrono::steady_clock::now() };
+        std::stringbuf buffer{};
+        const std::size_t romStart{ mWriter.romSize() };
+
+        try
+        {
+            mWriter.setOutput(&buffer);
+            mWriter.startFragment();
+            mWriter.setFileName(file);
+            translateVMFile(file, mWriter, mSymbols, mArena, mOptions, mPasses);
+            mFragments[file] = { time, buffer.str(), mWriter.romSize() - romStart };
+            if (failed != mFailed.end())
+                mFailed.erase(failed);
+            ++translated;
+            changed = true;
+
+            const std::chrono::duration<double, std::milli> elapsed{ std::chrono::steady_clock::now() - start };
+            std::cout << "Translated " << fs::path(file).filename().string() << " in "
+                << std::fixed << std::setprecision(3) << elapsed.count() << " ms" << '\n';
+        }
+        catch (const std::exception& e)
+        {
+            // The last good fragment stays until the file is fixed, the
+            // file is tried again once it is written to
+            std::cout << fs::path(file).filename().string() << ": " << e.what() << '\n';
+            mFailed[file] = time;
+        }
+
+        // buffer goes out of scope, the writer must not keep it
+        mWriter.setOutput(&mBootstrap);
+    }
+
+    if (changed)
+    {
+        writeOutput();
+        std::cout << "Wrote " << mAsmName << " (" << romSize() << " words)" << std::endl;
+    }
+    return translated;
+}
+
+std::size_t Watcher::romSize() const
+{
+    std::size_t size{ mBootstrapSize };
+    for (const auto& fragment : mFragments)
+        size += fragment.second.romSize;
+    return size;
+}
+
+void Watcher::writeOutput() const
+{
+    // Written next to the output and renamed over it so nothing
+    // ever reads a half written program
+    const std::string temporary{ mAsmName + ".tmp" };
+    {
+        std::ofstream out{ temporary, std::ios::trunc };
+        if (!out)
+            throw std::runtime_error{ "Could not open " + temporary };
+
+        out << mBootstrap.str();
+        for (const auto& fragment : mFragments)
+            out << fragment.second.text;
+    }
+    fs::rename(temporary, mAsmName);
+}
+
+void watch_VM_files(const std::string& f, const TranslatorOptions& options)
+{
+    try
+    {
+        Watcher watcher{ f, options };
+        if (options.optimizeSize)
+            std::cout << "-Os is ignored while watching" << '\n';
+
+        watcher.poll();
+        std::cout << "Watching " << f << " for changes, stop with Ctrl+C" << std::endl;
+
+        for (;;)
+        {
+            std::this_thread::sleep_for(WATCH_INTERVAL);
+            watcher.poll();
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << '\n';
+    }
+}